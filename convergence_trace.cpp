@@ -0,0 +1,68 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "convergence_trace.hpp"
+
+ConvergenceTrace::ConvergenceTrace(long capacity)
+    : start(chrono::steady_clock::now()), n_recorded(0)
+{
+    if (capacity < 1) {
+        throw invalid_argument("A trace needs room for at least one record");
+    }
+    records.resize(capacity);
+}
+
+// Records held, at most the capacity
+long ConvergenceTrace::size() const
+{
+    return min((long) n_recorded, (long) records.size());
+}
+
+long ConvergenceTrace::n_dropped() const
+{
+    return n_recorded - size();
+}
+
+/* Writes the records oldest first, as csv if filename ends in .csv and as a
+ * TraceHeader followed by the raw records otherwise
+ */
+void ConvergenceTrace::write(string filename) const
+{
+    long n = size();
+    long first = n_recorded - n;
+    bool csv = filename.size() > 4
+        and filename.substr(filename.size() - 4) == ".csv";
+
+    ofstream file(filename, csv ? ios::out : ios::out | ios::binary);
+    if (csv) {
+        file << "time_ms,evaluations,restart,current_score,best_score,"
+            "tile_a,tile_b\n";
+        for (long i = first; i < first + n; i++) {
+            const TraceRecord& r = records[i % records.size()];
+            file << r.time_ns / 1e6 << "," << r.evaluations << ","
+                << r.restart << "," << r.current_score << ","
+                << r.best_score << "," << r.tile_a << "," << r.tile_b << "\n";
+        }
+    } else {
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "TI4TRACE", sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.record_size = sizeof(TraceRecord);
+        header.n_records = n;
+        header.n_dropped = n_dropped();
+        file.write((const char*) &header, sizeof(header));
+        for (long i = first; i < first + n; i++) {
+            file.write((const char*) &records[i % records.size()],
+                    sizeof(TraceRecord));
+        }
+    }
+    file.close();
+    if (not file) {
+        cerr << "Could not write " << filename << endl;
+        exit(-1);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef TI4_CONVERGENCE_TRACE_HPP
+#define TI4_CONVERGENCE_TRACE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+// Bump whenever the layout of TraceHeader or TraceRecord changes
+#define TRACE_VERSION 1
+
+/* One point on the convergence curve of an optimization, recorded each time
+ * it moves to another grid. tile_a and tile_b are the numbers of the tiles
+ * swapped, or 0 for the grid a search starts and stops on
+ */
+typedef struct TraceRecord
+{
+    int64_t time_ns; // Since the trace was created
+    int64_t evaluations; // Grids scored by this restart so far
+    float current_score;
+    float best_score;
+    int32_t restart;
+    int32_t tile_a;
+    int32_t tile_b;
+    int32_t padding;
+} TraceRecord;
+
+/* Start of a binary trace file. n_records records follow it, oldest first
+ */
+typedef struct TraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t n_records;
+    uint64_t n_dropped; // Overwritten because the buffer was full
+} TraceHeader;
+
+/* A fixed size ring buffer of trace records, allocated up front so that
+ * recording a point costs one clock read and a few stores. Once it is full
+ * the oldest records are overwritten. Restarts running on other threads can
+ * record into the same trace, each taking its slot with one atomic increment
+ */
+class ConvergenceTrace
+{
+    chrono::steady_clock::time_point start;
+    vector<TraceRecord> records;
+    atomic<long> n_recorded;
+
+    public:
+    ConvergenceTrace(long capacity);
+    ConvergenceTrace(const ConvergenceTrace&) = delete;
+    void record(int restart, long evaluations, float current_score,
+            float best_score, int tile_a, int tile_b) {
+        TraceRecord& r = records[n_recorded++ % records.size()];
+        r.time_ns = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count();
+        r.evaluations = evaluations;
+        r.current_score = current_score;
+        r.best_score = best_score;
+        r.restart = restart;
+        r.tile_a = tile_a;
+        r.tile_b = tile_b;
+        r.padding = 0;
+    }
+    long size() const;
+    long n_dropped() const;
+    void write(string filename) const;
+};
+
+#endif
@@ -0,0 +1,1148 @@
+#include <mutex>
+
+#include "galaxy.hpp"
+
+/* Branch and bound over every placement of the movable systems, for --exact.
+ *
+ * The search first places the systems that change distances: movable home
+ * systems, then supernovas, then the other anomalies, empty systems and
+ * wormholes from the dearest to move through. Until they are all placed each
+ * distance is only known to lie between two bounds. The shortest is found as
+ * if every location left held the cheapest system left to move through, with
+ * any wormhole left. The longest is found as if they all held the dearest
+ * without wormholes, or the cheapest plus the extra cost of every system
+ * left. Those bound the stake each home system can have in each location,
+ * and so the least and the most of each share it can end up with. The least
+ * spread of shares within those ranges bounds each coefficient of variation
+ * in the score, as do the ranges of the differences between each pair of
+ * shares, together with the penalties between systems that are already next
+ * to each other.
+ *
+ * After that the distances, and so the stake each home system would have in
+ * every location left, no longer change. The remaining systems are then
+ * placed one location at a time. The share each home system ends up with
+ * lies between the least and the most the systems still to be placed could
+ * add to it, which bounds the spread as before, as do the ranges of the
+ * differences between each pair of shares. First turn shares are bounded
+ * the same way from the systems next to each home system. Trait counts are
+ * truncated as they are added up, so their variance is only bounded by 0.
+ * Systems that are alike are interchangeable, so only one of them is tried
+ * in each location.
+ *
+ * When a limit cuts the search short, every subtree left unsearched records
+ * its bound, and the least of them is the lower bound reported
+ */
+
+// Subtrees that could only beat the best grid by less than this are still
+// searched, so rounding in the bounds never cuts off a better grid
+#define EXACT_TOLERANCE 1e-4
+
+// Special placements this deep are handed out to the workers as tasks
+#define EXACT_TASK_DEPTH 2
+
+struct Galaxy::ExactSearch
+{
+    vector<Location> slots; // Locations of the movable systems
+    vector<vector<int>> adjacent_slots;
+    vector<vector<int>> adjacent_fixed; // Ids of systems that never move
+
+    // Every location in the galaxy as a node of a graph, for bounding the
+    // distances before all the specials are placed
+    vector<vector<int>> node_neighbours;
+    vector<int> node_tile; // Id of the system that never moves there, or -1
+    vector<int> node_slot; // -1 for systems that never move
+    vector<int> movable_ids;
+    int mecatol_id;
+    bool pie_slice_assignment;
+
+    // By tile id
+    vector<char> is_anomaly; // Not counting empty systems, as apply_penalties
+    vector<int> wormhole;
+    vector<char> is_home;
+    vector<int> move_cost; // As get_move_cost
+    vector<float> share_rows; // As TileAttributes::share_rows
+
+    float fixed_penalty = 0; // Penalties no placement avoids
+    vector<int> specials; // Ids, with systems that are alike next to each other
+    vector<char> like_previous;
+    vector<vector<int>> normal_classes; // Ids of normal systems that are alike
+    double weights[N_SHARE_KINDS];
+
+    mutex best_mutex;
+    atomic<float> best_score;
+    vector<int> best_tile_at; // Id of the system in each slot
+    atomic<bool> stop;
+    float abandoned_bound = INFINITY; // Least bound of the subtrees left unsearched
+
+    // What apply_penalties adds for system a being next to system b. Each
+    // pair is counted once from either side, as it is there
+    float pair_penalty(int a, int b) const {
+        float penalty = 0;
+        if (is_anomaly[a] and is_anomaly[b]) {
+            penalty += 1;
+        }
+        if (wormhole[a] and wormhole[a] == wormhole[b]) {
+            penalty += 2;
+        }
+        if (is_home[a] and is_home[b]) {
+            penalty += 5;
+        }
+        return penalty;
+    }
+
+    // Penalties every placement that keeps the systems already in tile_at
+    // (-1 for empty slots) has to pay
+    float penalty_bound(const vector<int>& tile_at) const {
+        float bound = fixed_penalty;
+        for (int s = 0; s < (int) slots.size(); s++) {
+            int a = tile_at[s];
+            if (a < 0) {
+                continue;
+            }
+            for (int f : adjacent_fixed[s]) {
+                bound += pair_penalty(a, f) + pair_penalty(f, a);
+            }
+            for (int other : adjacent_slots[s]) {
+                if (tile_at[other] >= 0) {
+                    bound += pair_penalty(a, tile_at[other]);
+                }
+            }
+        }
+        return bound;
+    }
+
+    double share_bound(const vector<int>& tile_at) const;
+
+    // Lowest score of any grid that keeps the specials already in tile_at
+    float bound(const vector<int>& tile_at) const {
+        float bound = penalty_bound(tile_at);
+        if (can_improve(bound)) {
+            bound += share_bound(tile_at);
+        }
+        return bound;
+    }
+
+    bool can_improve(float bound) const {
+        return bound < best_score + EXACT_TOLERANCE;
+    }
+
+    // Records a subtree the search stopped before searching
+    void abandon(float bound) {
+        lock_guard<mutex> lock(best_mutex);
+        abandoned_bound = MIN(abandoned_bound, bound);
+    }
+
+    void offer(float score, const vector<int>& tile_at) {
+        if (score >= best_score) {
+            return;
+        }
+        lock_guard<mutex> lock(best_mutex);
+        if (score < best_score) {
+            best_score = score;
+            best_tile_at = tile_at;
+        }
+    }
+};
+
+/* Least sum of squared distances from their mean of n values, with value i
+ * between low[i] and high[i] and a sum between low_sum and high_sum. Each
+ * value is as close as it can be to the mean, which is fixed if the sum is.
+ * Otherwise it is the level at which the values pulled up balance those
+ * pulled down
+ */
+static double least_spread(const double* low, const double* high, int n,
+        double low_sum, double high_sum)
+{
+    double a = INFINITY;
+    double b = -INFINITY;
+    for (int i = 0; i < n; i++) {
+        a = MIN(a, low[i]);
+        b = MAX(b, high[i]);
+    }
+    double level;
+    if (high_sum - low_sum < 1e-6 * fabs(high_sum)) {
+        level = high_sum / n;
+    } else {
+        for (int iteration = 0; iteration < 50; iteration++) {
+            level = (a + b) / 2;
+            double pull = 0;
+            for (int i = 0; i < n; i++) {
+                pull += MIN(MAX(level, low[i]), high[i]) - level;
+            }
+            if (pull > 0) {
+                a = level;
+            } else {
+                b = level;
+            }
+        }
+        level = (a + b) / 2;
+    }
+    double spread = 0;
+    for (int i = 0; i < n; i++) {
+        spread += pow(MIN(MAX(level, low[i]), high[i]) - level, 2);
+    }
+    return spread;
+}
+
+/* Least and most of the sum of values[i] * coefficients[p(i)] over every
+ * permutation p, both sorted ascending. Pairing high values with low
+ * coefficients gives the least
+ */
+static void pair_extremes(const vector<double>& values, 
+        const vector<double>& coefficients, double& least, double& most)
+{
+    int r = values.size();
+    least = 0;
+    most = 0;
+    for (int i = 0; i < r; i++) {
+        least += values[i] * coefficients[r - 1 - i];
+        most += values[i] * coefficients[i];
+    }
+}
+
+/* Fills distances with the length of the shortest path from node source to
+ * every node, or UNREACHABLE. Leaving node v costs cost[v] tenths of a move,
+ * or is impossible if that is negative. Nodes with a bit of wormholes in
+ * common are next to each other, and blocked nodes cannot be entered
+ */
+static void bounded_distances(const vector<vector<int>>& neighbours, 
+        int source, const vector<int>& cost, const vector<int>& wormholes, 
+        const vector<char>& blocked, double* distances)
+{
+    int n = neighbours.size();
+    vector<int> lengths(n, INT_MAX);
+    vector<char> settled(n, false);
+    lengths[source] = 0;
+    while (true) {
+        int u = -1;
+        for (int v = 0; v < n; v++) {
+            if (not settled[v] and lengths[v] != INT_MAX 
+                    and (u < 0 or lengths[v] < lengths[u])) {
+                u = v;
+            }
+        }
+        if (u < 0) {
+            break;
+        }
+        settled[u] = true;
+        if (cost[u] < 0) {
+            continue;
+        }
+        int length = lengths[u] + cost[u];
+        auto visit = [&](int v) {
+            if (not blocked[v] and length < lengths[v]) {
+                lengths[v] = length;
+            }
+        };
+        for (int v : neighbours[u]) {
+            visit(v);
+        }
+        if (wormholes[u]) {
+            for (int v = 0; v < n; v++) {
+                if (v != u and wormholes[u] & wormholes[v]) {
+                    visit(v);
+                }
+            }
+        }
+    }
+    for (int v = 0; v < n; v++) {
+        distances[v] = lengths[v] == INT_MAX ? UNREACHABLE 
+            : (double) lengths[v] / MOVE_COST_SCALE;
+    }
+}
+
+/* Lowest total of the weighted coefficients of variation of the shares in
+ * any grid that keeps the specials already in tile_at, or 0 until every
+ * home system is placed. See the top of the file
+ */
+double Galaxy::ExactSearch::share_bound(const vector<int>& tile_at) const
+{
+    int n_nodes = node_neighbours.size();
+
+    // Systems left to place, and what the locations left could hold
+    vector<char> placed(is_home.size(), false);
+    for (int id : tile_at) {
+        if (id >= 0) {
+            placed[id] = true;
+        }
+    }
+    vector<int> left;
+    int cheapest = INT_MAX;
+    int dearest = 0;
+    int extra_cost = 0; // Over the cheapest, of all the systems left
+    int left_wormholes = 0;
+    for (int id : movable_ids) {
+        if (placed[id]) {
+            continue;
+        }
+        if (is_home[id]) {
+            return 0;
+        }
+        left.push_back(id);
+        cheapest = MIN(cheapest, move_cost[id]);
+        dearest = move_cost[id] < 0 or dearest < 0 ? -1 : MAX(dearest, move_cost[id]);
+        left_wormholes |= wormhole[id] ? 1 << wormhole[id] : 0;
+    }
+    for (int id : left) {
+        extra_cost += move_cost[id] - cheapest;
+    }
+
+    // The shortest distances with the cheapest systems and every wormhole
+    // left in the empty locations. The longest are those with the dearest
+    // systems and no wormholes there, or with the cheapest systems plus the
+    // extra cost of every system left, whichever is less. A supernova left
+    // could block any path through an empty location
+    vector<int> low_cost(n_nodes);
+    vector<int> cheap_cost(n_nodes);
+    vector<int> high_cost(n_nodes);
+    vector<int> low_wormholes(n_nodes);
+    vector<int> high_wormholes(n_nodes);
+    vector<char> blocked(n_nodes, false);
+    vector<int> home_nodes;
+    vector<int> empty_nodes;
+    for (int v = 0; v < n_nodes; v++) {
+        int id = node_slot[v] < 0 ? node_tile[v] : tile_at[node_slot[v]];
+        if (id < 0) {
+            low_cost[v] = cheap_cost[v] = cheapest;
+            high_cost[v] = dearest;
+            low_wormholes[v] = left_wormholes;
+            high_wormholes[v] = 0;
+            empty_nodes.push_back(v);
+            continue;
+        }
+        low_cost[v] = cheap_cost[v] = high_cost[v] = move_cost[id];
+        low_wormholes[v] = high_wormholes[v] = wormhole[id] ? 1 << wormhole[id] : 0;
+        if (is_home[id]) {
+            blocked[v] = true;
+            home_nodes.push_back(v);
+        }
+    }
+    int n_hs = home_nodes.size();
+    vector<double> low_distances(n_hs * n_nodes);
+    vector<double> high_distances(n_hs * n_nodes);
+    vector<double> cheap_distances(n_nodes);
+    for (int hs = 0; hs < n_hs; hs++) {
+        double* high = &high_distances[hs * n_nodes];
+        bounded_distances(node_neighbours, home_nodes[hs], low_cost, 
+                low_wormholes, blocked, &low_distances[hs * n_nodes]);
+        bounded_distances(node_neighbours, home_nodes[hs], high_cost, 
+                high_wormholes, blocked, high);
+        if (dearest < 0) {
+            continue;
+        }
+        bounded_distances(node_neighbours, home_nodes[hs], cheap_cost, 
+                high_wormholes, blocked, cheap_distances.data());
+        for (int v = 0; v < n_nodes; v++) {
+            high[v] = MIN(high[v], cheap_distances[v] 
+                    + (double) extra_cost / MOVE_COST_SCALE);
+        }
+    }
+
+    // The least and the most stake each home system can have in a system at
+    // node v, as split_stake gives them, and then of all of them together.
+    // Together they have all of a system that any of them can reach
+    vector<double> closeness(n_hs);
+    vector<double> farness(n_hs);
+    auto stake_range = [&](int v, bool may_pie_slice, double* least, 
+            double* most) {
+        double nearest = INFINITY;
+        bool surely_reached = false;
+        for (int hs = 0; hs < n_hs; hs++) {
+            nearest = MIN(nearest, low_distances[hs * n_nodes + v]);
+            surely_reached |= high_distances[hs * n_nodes + v] != UNREACHABLE;
+            closeness[hs] = 1.0 / pow(low_distances[hs * n_nodes + v], 2);
+            farness[hs] = 1.0 / pow(high_distances[hs * n_nodes + v], 2);
+        }
+        least[n_hs] = surely_reached;
+        most[n_hs] = nearest != UNREACHABLE;
+        for (int hs = 0; hs < n_hs; hs++) {
+            if (nearest == UNREACHABLE) {
+                least[hs] = most[hs] = 0;
+                continue;
+            } else if (nearest < 3 and pie_slice_assignment and may_pie_slice) {
+                least[hs] = 0;
+                most[hs] = 1;
+                continue;
+            }
+            double most_others = 0;
+            double least_others = 0;
+            for (int other = 0; other < n_hs; other++) {
+                if (other != hs) {
+                    most_others += closeness[other];
+                    least_others += farness[other];
+                }
+            }
+            least[hs] = farness[hs] ? farness[hs] / (farness[hs] + most_others) : 0;
+            most[hs] = closeness[hs] ? closeness[hs] / (closeness[hs] + least_others) : 0;
+        }
+    };
+
+    // Stake ranges of the systems already placed, and the coefficients the
+    // systems left could be paired with in the empty locations
+    vector<int> placed_ids;
+    vector<double> placed_least;
+    vector<double> placed_most;
+    vector<vector<double>> empty_least(n_hs + 1);
+    vector<vector<double>> empty_most(n_hs + 1);
+    vector<double> least(n_hs + 1);
+    vector<double> most(n_hs + 1);
+    for (int v = 0; v < n_nodes; v++) {
+        int id = node_slot[v] < 0 ? node_tile[v] : tile_at[node_slot[v]];
+        if (id >= 0 and is_home[id]) {
+            continue;
+        }
+        stake_range(v, id != mecatol_id, least.data(), most.data());
+        if (id >= 0) {
+            placed_ids.push_back(id);
+            placed_least.insert(placed_least.end(), least.begin(), least.end());
+            placed_most.insert(placed_most.end(), most.begin(), most.end());
+            continue;
+        }
+        for (int hs = 0; hs <= n_hs; hs++) {
+            empty_least[hs].push_back(least[hs]);
+            empty_most[hs].push_back(most[hs]);
+        }
+    }
+    vector<vector<double>> empty_least_unsorted = empty_least;
+    vector<vector<double>> empty_most_unsorted = empty_most;
+    for (int hs = 0; hs <= n_hs; hs++) {
+        sort(empty_least[hs].begin(), empty_least[hs].end());
+        sort(empty_most[hs].begin(), empty_most[hs].end());
+    }
+
+    // The same for the difference between the stakes of each pair of home
+    // systems
+    vector<pair<int, int>> home_pairs;
+    for (int a = 0; a < n_hs; a++) {
+        for (int b = a + 1; b < n_hs; b++) {
+            home_pairs.push_back({a, b});
+        }
+    }
+    vector<vector<double>> empty_least_difference(home_pairs.size());
+    vector<vector<double>> empty_most_difference(home_pairs.size());
+    for (int p = 0; p < (int) home_pairs.size(); p++) {
+        int a = home_pairs[p].first;
+        int b = home_pairs[p].second;
+        for (int i = 0; i < (int) empty_nodes.size(); i++) {
+            empty_least_difference[p].push_back(
+                    empty_least_unsorted[a][i] - empty_most_unsorted[b][i]);
+            empty_most_difference[p].push_back(
+                    empty_most_unsorted[a][i] - empty_least_unsorted[b][i]);
+        }
+        sort(empty_least_difference[p].begin(), empty_least_difference[p].end());
+        sort(empty_most_difference[p].begin(), empty_most_difference[p].end());
+    }
+
+    double total = 0;
+    vector<double> values;
+    vector<double> low(n_hs + 1);
+    vector<double> high(n_hs + 1);
+    for (int k = 0; k < N_SHARE_KINDS; k++) {
+        if (not weights[k]) {
+            continue;
+        }
+        values.clear();
+        for (int id : left) {
+            values.push_back(share_rows[id * SHARE_COLUMNS + k]);
+        }
+        sort(values.begin(), values.end());
+        double most_low = 0;
+        double most_high = 0;
+        for (int hs = 0; hs <= n_hs; hs++) {
+            double unused;
+            pair_extremes(values, empty_least[hs], low[hs], unused);
+            pair_extremes(values, empty_most[hs], unused, high[hs]);
+            for (int i = 0; i < (int) placed_ids.size(); i++) {
+                double value = share_rows[placed_ids[i] * SHARE_COLUMNS + k];
+                low[hs] += value * placed_least[i * (n_hs + 1) + hs];
+                high[hs] += value * placed_most[i * (n_hs + 1) + hs];
+            }
+            if (hs < n_hs) {
+                most_low += low[hs];
+                most_high += high[hs];
+            }
+        }
+        double low_sum = MAX(low[n_hs], most_low);
+        double high_sum = MIN(high[n_hs], most_high);
+        if (high_sum <= 0) {
+            continue;
+        }
+        double spread = least_spread(low.data(), high.data(), n_hs, 
+                low_sum, high_sum);
+
+        // The spread is also the sum of the squared differences between each
+        // pair of shares, over n_hs
+        double pair_spread = 0;
+        for (int p = 0; p < (int) home_pairs.size(); p++) {
+            int a = home_pairs[p].first;
+            int b = home_pairs[p].second;
+            double least;
+            double most;
+            double unused;
+            pair_extremes(values, empty_least_difference[p], least, unused);
+            pair_extremes(values, empty_most_difference[p], unused, most);
+            for (int i = 0; i < (int) placed_ids.size(); i++) {
+                double value = share_rows[placed_ids[i] * SHARE_COLUMNS + k];
+                least += value * (placed_least[i * (n_hs + 1) + a] 
+                        - placed_most[i * (n_hs + 1) + b]);
+                most += value * (placed_most[i * (n_hs + 1) + a] 
+                        - placed_least[i * (n_hs + 1) + b]);
+            }
+            if (least > 0) {
+                pair_spread += pow(least, 2);
+            } else if (most < 0) {
+                pair_spread += pow(most, 2);
+            }
+        }
+        spread = MAX(spread, pair_spread / n_hs);
+        total += weights[k] * spread / high_sum;
+    }
+    return total;
+}
+
+static bool alike(const TileAttributes& attributes, Tile* a, Tile* b)
+{
+    int x = a->get_id();
+    int y = b->get_id();
+    if (a->get_anomaly() != b->get_anomaly()
+            or a->get_wormhole() != b->get_wormhole()
+            or a->is_home_system() or b->is_home_system()
+            or attributes.resources[x] != attributes.resources[y]
+            or attributes.influence[x] != attributes.influence[y]
+            or attributes.res_inf[x] != attributes.res_inf[y]
+            or attributes.has_tech[x] != attributes.has_tech[y]) {
+        return false;
+    }
+    for (auto& counts : attributes.trait_counts) {
+        if (counts[x] != counts[y]) {
+            return false;
+        }
+    }
+    for (int k = 0; k < SHARE_COLUMNS; k++) {
+        if (attributes.share_rows[x * SHARE_COLUMNS + k]
+                != attributes.share_rows[y * SHARE_COLUMNS + k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Splits tiles into groups of alike systems, in the order they first appear
+static vector<vector<int>> group_alike(const TileAttributes& attributes,
+        const vector<Tile*>& tiles)
+{
+    vector<vector<Tile*>> groups;
+    for (auto t : tiles) {
+        auto group = groups.begin();
+        while (group != groups.end() and not alike(attributes, (*group)[0], t)) {
+            group++;
+        }
+        if (group == groups.end()) {
+            groups.push_back({t});
+        } else {
+            group->push_back(t);
+        }
+    }
+
+    vector<vector<int>> ids;
+    for (auto& group : groups) {
+        ids.push_back({});
+        for (auto t : group) {
+            ids.back().push_back(t->get_id());
+        }
+    }
+    return ids;
+}
+
+/* Places the special system at depth in every slot left for it, going
+ * deeper wherever the bound does not rule out a better grid. Alike systems
+ * only go in increasing slots, so each set of their locations is tried once.
+ * special_slots holds the slot of each special placed so far, and bound is
+ * the bound of the placement in tile_at
+ */
+void Galaxy::exact_place_specials(ExactSearch& search, vector<int>& tile_at,
+        vector<int>& special_slots, int depth, float bound, SearchBudget& budget)
+{
+    if (search.stop or budget.is_exhausted()) {
+        search.stop = true;
+        search.abandon(bound);
+        return;
+    }
+    budget.n_evaluations++;
+    if (depth == (int) search.specials.size()) {
+        exact_place_normals(search, tile_at, budget);
+        return;
+    }
+
+    // Try the most promising slot first. Once stopped, each placement left
+    // still records its bound on the way out
+    int id = search.specials[depth];
+    int first = search.like_previous[depth] ? special_slots[depth - 1] + 1 : 0;
+    vector<pair<float, int>> children;
+    for (int s = first; s < (int) search.slots.size(); s++) {
+        if (tile_at[s] >= 0) {
+            continue;
+        }
+        tile_at[s] = id;
+        children.push_back({search.bound(tile_at), s});
+        tile_at[s] = -1;
+    }
+    sort(children.begin(), children.end());
+    for (auto& child : children) {
+        if (not search.can_improve(child.first)) {
+            break;
+        }
+        int s = child.second;
+        tile_at[s] = id;
+        special_slots[depth] = s;
+        exact_place_specials(search, tile_at, special_slots, depth + 1,
+                child.first, budget);
+        tile_at[s] = -1;
+    }
+}
+
+/* With every special system placed, tries every way of filling the slots
+ * left with the normal systems
+ */
+void Galaxy::exact_place_normals(ExactSearch& search, vector<int>& tile_at,
+        SearchBudget& budget)
+{
+    // Fill the free slots in any order to find the distances and penalties,
+    // which no longer depend on the order
+    vector<int> free_slots;
+    for (int s = 0; s < (int) search.slots.size(); s++) {
+        if (tile_at[s] < 0) {
+            free_slots.push_back(s);
+        }
+    }
+    vector<int> placement = tile_at;
+    auto free_slot = free_slots.begin();
+    for (auto& normal_class : search.normal_classes) {
+        for (int id : normal_class) {
+            placement[*free_slot++] = id;
+        }
+    }
+    auto place = [&]() {
+        for (int s = 0; s < (int) search.slots.size(); s++) {
+            place_tile(search.slots[s], tiles_by_id[placement[s]]);
+        }
+        search.offer(evaluate_grid(), placement);
+    };
+    place();
+
+    // Which home systems lack planets next to them depends on the normal
+    // systems, every other penalty is settled
+    float penalty = 0;
+    for (int k = 0; k < N_PENALTY_KINDS; k++) {
+        if (k != HOMES_WITHOUT_PLANETS_PENALTY) {
+            penalty += scores.penalties[k];
+        }
+    }
+    int m = free_slots.size();
+    if (not m or not search.can_improve(penalty)) {
+        return;
+    }
+
+    int n_hs = home_systems.size();
+
+    // Slots that mostly go to one home system decide the most, so they are
+    // filled first
+    auto lopsidedness = [&](int s) {
+        int id = placement[s];
+        float least = INFINITY;
+        float most = -INFINITY;
+        for (int hs = 0; hs < n_hs; hs++) {
+            least = MIN(least, stakes[hs][id]);
+            most = MAX(most, stakes[hs][id]);
+        }
+        return most - least;
+    };
+    stable_sort(free_slots.begin(), free_slots.end(), [&](int a, int b) {
+        return lopsidedness(a) > lopsidedness(b);
+    });
+
+    int n_classes = search.normal_classes.size();
+    TileMatrix free_distances;
+    TileMatrix free_stakes; // What each home system would get of each free slot
+    free_distances.resize(n_hs, m);
+    free_stakes.resize(n_hs, m);
+    vector<int> free_index(tiles_by_id.size(), -1);
+    for (int j = 0; j < m; j++) {
+        int id = placement[free_slots[j]];
+        free_index[id] = j;
+        for (int hs = 0; hs < n_hs; hs++) {
+            free_distances[hs][j] = home_distances[hs][id];
+        }
+        split_stake(j, true, free_distances, free_stakes);
+    }
+
+    // Shares from the systems that are already settled, [k * n_hs + hs]
+    vector<double> settled(N_SHARE_KINDS * n_hs, 0);
+    for (int id = 0; id < (int) tiles_by_id.size(); id++) {
+        if (free_index[id] >= 0) {
+            continue;
+        }
+        for (int k = 0; k < N_SHARE_KINDS; k++) {
+            for (int hs = 0; hs < n_hs; hs++) {
+                settled[k * n_hs + hs] +=
+                    tile_attributes.share_rows[id * SHARE_COLUMNS + k]
+                    * stakes[hs][id];
+            }
+        }
+    }
+
+    // Coefficients of the shares from free slots j onwards, ascending, in
+    // rows of n_coefficients: the stakes of each home system, of all of them
+    // together, and the difference between the stakes of each pair of them
+    vector<pair<int, int>> home_pairs;
+    for (int a = 0; a < n_hs; a++) {
+        for (int b = a + 1; b < n_hs; b++) {
+            home_pairs.push_back({a, b});
+        }
+    }
+    int n_coefficients = n_hs + 1 + home_pairs.size();
+    vector<vector<double>> later_coefficients((m + 1) * n_coefficients);
+    for (int j = 0; j <= m; j++) {
+        auto row = later_coefficients.begin() + j * n_coefficients;
+        for (int i = j; i < m; i++) {
+            double total = 0;
+            for (int hs = 0; hs < n_hs; hs++) {
+                row[hs].push_back(free_stakes[hs][i]);
+                total += free_stakes[hs][i];
+            }
+            row[n_hs].push_back(total);
+            for (int p = 0; p < (int) home_pairs.size(); p++) {
+                row[n_hs + 1 + p].push_back(free_stakes[home_pairs[p].first][i]
+                        - free_stakes[home_pairs[p].second][i]);
+            }
+        }
+        for (int c = 0; c < n_coefficients; c++) {
+            sort(row[c].begin(), row[c].end());
+        }
+    }
+
+    // The first turn share of a home system is made of its two best
+    // adjacent systems. Each is in a free slot, or has a settled value
+    vector<vector<pair<int, double>>> first_turn_options(n_hs);
+    for (int hs = 0; hs < n_hs; hs++) {
+        for (auto t : get_adjacent(home_systems[hs])) {
+            int id = t->get_id();
+            first_turn_options[hs].push_back({free_index[id], 
+                    tile_attributes.res_inf[id] * stakes[hs][id]});
+        }
+    }
+
+    vector<int> counts;
+    for (auto& normal_class : search.normal_classes) {
+        counts.push_back(normal_class.size());
+    }
+    auto value = [&](int c, int k) -> double {
+        return tile_attributes.share_rows[search.normal_classes[c][0]
+            * SHARE_COLUMNS + k];
+    };
+    auto res_inf = [&](int c) -> double {
+        return tile_attributes.res_inf[search.normal_classes[c][0]];
+    };
+    vector<int> chosen(m);
+
+    // Lowest score of any grid that puts the systems in counts into free
+    // slots j onwards, with the classes in chosen before that and shares
+    // from the rest. Neither the ring balance nor home systems without
+    // planets are counted
+    vector<double> values;
+    vector<double> low(n_hs);
+    vector<double> high(n_hs);
+    vector<double> lows;
+    vector<double> highs;
+    auto bound = [&](int j, const vector<double>& shares) {
+        double total = penalty;
+        auto row = later_coefficients.begin() + j * n_coefficients;
+        for (int k = 0; k < N_SHARE_KINDS; k++) {
+            if (not search.weights[k]) {
+                continue;
+            }
+            values.clear();
+            for (int c = 0; c < n_classes; c++) {
+                values.insert(values.end(), counts[c], value(c, k));
+            }
+            sort(values.begin(), values.end());
+
+            double least;
+            double most;
+            double high_sum = 0;
+            double most_high = 0;
+            for (int hs = 0; hs < n_hs; hs++) {
+                pair_extremes(values, row[hs], least, most);
+                low[hs] = shares[k * n_hs + hs] + least;
+                high[hs] = shares[k * n_hs + hs] + most;
+                high_sum += shares[k * n_hs + hs];
+                most_high += high[hs];
+            }
+            double low_sum = high_sum;
+            pair_extremes(values, row[n_hs], least, most);
+            low_sum += least;
+            high_sum = MIN(high_sum + most, most_high);
+            if (high_sum <= 0) {
+                continue;
+            }
+            double spread = least_spread(low.data(), high.data(), n_hs, 
+                    low_sum, high_sum);
+
+            // The spread is also the sum of the squared differences between
+            // each pair of shares, over n_hs
+            double pair_spread = 0;
+            for (int p = 0; p < (int) home_pairs.size(); p++) {
+                double difference = shares[k * n_hs + home_pairs[p].first] 
+                    - shares[k * n_hs + home_pairs[p].second];
+                pair_extremes(values, row[n_hs + 1 + p], least, most);
+                if (difference + least > 0) {
+                    pair_spread += pow(difference + least, 2);
+                } else if (difference + most < 0) {
+                    pair_spread += pow(difference + most, 2);
+                }
+            }
+            spread = MAX(spread, pair_spread / n_hs);
+            total += search.weights[k] * spread / high_sum;
+        }
+
+        if (evaluation_config.first_turn) {
+            double least = INFINITY;
+            double most = 0;
+            for (int c = 0; c < n_classes; c++) {
+                if (counts[c]) {
+                    least = MIN(least, res_inf(c));
+                    most = MAX(most, res_inf(c));
+                }
+            }
+            double low_sum = 0;
+            double high_sum = 0;
+            for (int hs = 0; hs < n_hs; hs++) {
+                lows.clear();
+                highs.clear();
+                for (auto& option : first_turn_options[hs]) {
+                    int i = option.first;
+                    if (i < 0) {
+                        lows.push_back(option.second);
+                        highs.push_back(option.second);
+                    } else if (i < j) {
+                        lows.push_back(res_inf(chosen[i]) * free_stakes[hs][i]);
+                        highs.push_back(lows.back());
+                    } else {
+                        lows.push_back(least * free_stakes[hs][i]);
+                        highs.push_back(most * free_stakes[hs][i]);
+                    }
+                }
+                if (lows.size() < 2) {
+                    return total;
+                }
+                partial_sort(lows.begin(), lows.begin() + 2, lows.end(), 
+                        greater<double>());
+                partial_sort(highs.begin(), highs.begin() + 2, highs.end(), 
+                        greater<double>());
+                low[hs] = lows[0] + lows[1];
+                high[hs] = highs[0] + highs[1];
+                low_sum += low[hs];
+                high_sum += high[hs];
+            }
+            if (high_sum > 0) {
+                total += evaluation_config.first_turn * least_spread(low.data(), 
+                        high.data(), n_hs, low_sum, high_sum) / high_sum;
+            }
+        }
+        return total;
+    };
+
+    function<void(int, const vector<double>&, double)> place_from =
+            [&](int j, const vector<double>& shares, double node_bound) {
+        if (search.stop or budget.is_exhausted()) {
+            search.stop = true;
+            search.abandon(node_bound);
+            return;
+        }
+        budget.n_evaluations++;
+        if (j == m) {
+            vector<int> next_member(n_classes, 0);
+            for (int i = 0; i < m; i++) {
+                int c = chosen[i];
+                placement[free_slots[i]] = search.normal_classes[c][next_member[c]++];
+            }
+            place();
+            return;
+        }
+
+        // Try the most promising class of system in slot j first
+        vector<pair<double, int>> children;
+        vector<vector<double>> child_shares(n_classes);
+        for (int c = 0; c < n_classes; c++) {
+            if (not counts[c]) {
+                continue;
+            }
+            child_shares[c] = shares;
+            for (int k = 0; k < N_SHARE_KINDS; k++) {
+                for (int hs = 0; hs < n_hs; hs++) {
+                    child_shares[c][k * n_hs + hs] += value(c, k) * free_stakes[hs][j];
+                }
+            }
+            chosen[j] = c;
+            counts[c]--;
+            children.push_back({bound(j + 1, child_shares[c]), c});
+            counts[c]++;
+        }
+        sort(children.begin(), children.end());
+        for (auto& child : children) {
+            if (not search.can_improve(child.first)) {
+                break;
+            }
+            int c = child.second;
+            chosen[j] = c;
+            counts[c]--;
+            place_from(j + 1, child_shares[c], child.first);
+            counts[c]++;
+        }
+    };
+    place_from(0, settled, bound(0, settled));
+}
+
+/* Searches every placement of the movable systems for one that scores better
+ * than the current grid, split into tasks for n_threads workers, and moves
+ * to the best found. The workers share what is left of budget, with at most
+ * max_evaluations counted in all (0 for no limit). Records in exact_result 
+ * whether no better placement can exist, or the lowest score one could have
+ * if a limit cut the search short
+ */
+void Galaxy::branch_and_bound(const OptimizerOptions& options, 
+        long max_evaluations, SearchBudget& budget)
+{
+    ExactSearch search;
+    search.slots = get_placement();
+    int n_slots = search.slots.size();
+    search.best_score = evaluate_grid();
+    search.stop = false;
+    for (int s = 0; s < n_slots; s++) {
+        search.best_tile_at.push_back(grid[get_cell_index(search.slots[s])]->get_id());
+    }
+
+    int n_ids = tiles_by_id.size();
+    search.is_anomaly.resize(n_ids);
+    search.wormhole.resize(n_ids);
+    search.is_home.resize(n_ids);
+    search.move_cost.resize(n_ids);
+    for (auto t : tiles_by_id) {
+        int id = t->get_id();
+        search.is_anomaly[id] = t->get_anomaly() and t->get_anomaly() != EMPTY;
+        search.wormhole[id] = t->get_wormhole();
+        search.is_home[id] = t->is_home_system();
+        search.move_cost[id] = get_move_cost(t);
+    }
+    search.share_rows = tile_attributes.share_rows;
+    for (auto t : movable_systems) {
+        search.movable_ids.push_back(t->get_id());
+    }
+    search.mecatol_id = mecatol->get_id();
+    search.pie_slice_assignment = evaluation_config.pie_slice_assignment;
+
+    vector<int> slot_of_cell(grid.size(), -1);
+    for (int s = 0; s < n_slots; s++) {
+        slot_of_cell[get_cell_index(search.slots[s])] = s;
+    }
+    vector<int> node_of_cell(grid.size(), -1);
+    for (int cell = 0; cell < (int) grid.size(); cell++) {
+        if (grid[cell] and grid[cell] != &boundary_tile) {
+            node_of_cell[cell] = search.node_tile.size();
+            search.node_slot.push_back(slot_of_cell[cell]);
+            search.node_tile.push_back(slot_of_cell[cell] < 0 
+                    ? grid[cell]->get_id() : -1);
+        }
+    }
+    search.node_neighbours.resize(search.node_tile.size());
+    for (int cell = 0; cell < (int) grid.size(); cell++) {
+        if (node_of_cell[cell] < 0) {
+            continue;
+        }
+        for (int k = adjacency_offsets[cell]; k < adjacency_offsets[cell + 1]; k++) {
+            if (node_of_cell[adjacent_cells[k]] >= 0) {
+                search.node_neighbours[node_of_cell[cell]].push_back(
+                        node_of_cell[adjacent_cells[k]]);
+            }
+        }
+    }
+    search.adjacent_slots.resize(n_slots);
+    search.adjacent_fixed.resize(n_slots);
+    for (int cell = 0; cell < (int) grid.size(); cell++) {
+        if (not grid[cell] or grid[cell] == &boundary_tile) {
+            continue;
+        }
+        for (int k = adjacency_offsets[cell]; k < adjacency_offsets[cell + 1]; k++) {
+            int other = adjacent_cells[k];
+            if (not grid[other]) {
+                continue;
+            }
+            int s = slot_of_cell[cell];
+            if (s >= 0 and slot_of_cell[other] >= 0) {
+                search.adjacent_slots[s].push_back(slot_of_cell[other]);
+            } else if (s >= 0) {
+                search.adjacent_fixed[s].push_back(grid[other]->get_id());
+            } else if (slot_of_cell[other] < 0) {
+                search.fixed_penalty += search.pair_penalty(
+                        grid[cell]->get_id(), grid[other]->get_id());
+            }
+        }
+    }
+
+    // A race condition that fails even with every system at no distance
+    // fails however the systems are placed
+    TileMatrix no_distances;
+    no_distances.resize(home_systems.size(), n_ids);
+    const EvaluationConfig& config = evaluation_config;
+    if (config.muaat_gets_supernova and not is_supernova_near_muaat(
+                config.muaat_gets_supernova, no_distances)) {
+        search.fixed_penalty += 10;
+    }
+    if (config.creuss_gets_wormhole and not is_wormhole_near_creuss(
+                config.creuss_gets_wormhole, no_distances)) {
+        search.fixed_penalty += 10;
+    }
+    if (config.saar_get_asteroids and not is_asteroid_near_saar(
+                config.saar_get_asteroids, no_distances)) {
+        search.fixed_penalty += 10;
+    }
+    if (config.winnu_have_clear_path_to_mecatol
+            and not winnu_have_clear_path_to_mecatol(no_distances)) {
+        search.fixed_penalty += 10;
+    }
+
+    vector<Tile*> specials;
+    vector<Tile*> normals;
+    for (auto t : movable_systems) {
+        if (t->get_anomaly() or t->get_wormhole() or t->is_home_system()) {
+            specials.push_back(t);
+        } else {
+            normals.push_back(t);
+        }
+    }
+    // Home systems and the systems that are hardest to move through change
+    // the distances the most, so they are placed first
+    auto placement_order = [&](const vector<int>& group) {
+        int id = group[0];
+        if (search.is_home[id]) {
+            return 0;
+        } else if (search.move_cost[id] < 0) {
+            return 1;
+        }
+        return 2 + MAX_MOVE_COST - search.move_cost[id];
+    };
+    auto special_groups = group_alike(tile_attributes, specials);
+    stable_sort(special_groups.begin(), special_groups.end(),
+            [&](const vector<int>& a, const vector<int>& b) {
+        return placement_order(a) < placement_order(b);
+    });
+    for (auto& group : special_groups) {
+        for (int i = 0; i < (int) group.size(); i++) {
+            search.specials.push_back(group[i]);
+            search.like_previous.push_back(i > 0);
+        }
+    }
+    search.normal_classes = group_alike(tile_attributes, normals);
+    for (int k = 0; k < N_SHARE_KINDS; k++) {
+        search.weights[k] = 0;
+    }
+    search.weights[RESOURCE_SHARE] = config.resource_weight;
+    search.weights[INFLUENCE_SHARE] = config.influence_weight;
+    search.weights[RES_INF_SHARE] = config.res_inf_weight;
+    search.weights[TECH_SHARE] = config.tech_weight;
+
+    // Split the search into every placement of the first few specials
+    typedef struct Task
+    {
+        vector<int> tile_at;
+        vector<int> special_slots;
+        float bound;
+    } Task;
+    vector<Task> tasks;
+    int task_depth = MIN(EXACT_TASK_DEPTH, (int) search.specials.size());
+    Task root = {vector<int>(n_slots, -1), vector<int>(search.specials.size()),
+        search.fixed_penalty};
+    function<void(Task&, int)> split = [&](Task& task, int depth) {
+        if (depth == task_depth) {
+            task.bound = search.bound(task.tile_at);
+            tasks.push_back(task);
+            return;
+        }
+        int first = search.like_previous[depth] ? task.special_slots[depth - 1] + 1 : 0;
+        for (int s = first; s < n_slots; s++) {
+            if (task.tile_at[s] < 0) {
+                task.tile_at[s] = search.specials[depth];
+                task.special_slots[depth] = s;
+                split(task, depth + 1);
+                task.tile_at[s] = -1;
+            }
+        }
+    };
+    split(root, 0);
+    stable_sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) {
+        return a.bound < b.bound;
+    });
+
+    int n_workers = MAX(MIN(options.n_threads, (int) tasks.size()), 1);
+    vector<unique_ptr<Galaxy>> workers;
+    vector<unique_ptr<SearchBudget>> budgets;
+    for (int worker = 0; worker < n_workers; worker++) {
+        workers.push_back(unique_ptr<Galaxy>(clone()));
+        // Each worker counts only its own work, added back in at the end
+        workers.back()->stats = GeneratorStats();
+        workers.back()->stats.timed = stats.timed;
+        budgets.push_back(unique_ptr<SearchBudget>(new SearchBudget(
+                        budget.share(max_evaluations, n_workers))));
+    }
+    // Tasks handed out after the search stops only record their bound
+    atomic<int> next_task(0);
+    auto work = [&](int worker) {
+        for (int i = next_task++; i < (int) tasks.size(); i = next_task++) {
+            Task& task = tasks[i];
+            if (search.can_improve(task.bound)) {
+                workers[worker]->exact_place_specials(search, task.tile_at,
+                        task.special_slots, task_depth, task.bound, 
+                        *budgets[worker]);
+            }
+        }
+    };
+    vector<thread> threads;
+    for (int worker = 1; worker < n_workers; worker++) {
+        threads.push_back(thread(work, worker));
+    }
+    work(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    exact_result = ExactResult();
+    exact_result.searched = true;
+    exact_result.proven = not search.stop;
+    exact_result.lower_bound = MIN((float) search.best_score, search.abandoned_bound);
+    exact_result.unavoidable_penalty = search.fixed_penalty;
+    StopReason stop = CONVERGED;
+    for (int worker = 0; worker < n_workers; worker++) {
+        exact_result.nodes += budgets[worker]->n_evaluations;
+        if (stop == CONVERGED) {
+            stop = budgets[worker]->stop_reason;
+        }
+        stats.add(workers[worker]->stats);
+    }
+    budget.n_evaluations += exact_result.nodes;
+    budget.stop_reason = exact_result.proven ? CONVERGED : stop;
+
+    if (options.verbose) {
+        if (exact_result.proven) {
+            printf("Branch and bound proved score %0.4f optimal after %ld nodes\n",
+                    (float) search.best_score, exact_result.nodes);
+        } else {
+            printf("Branch and bound stopped after %ld nodes, best score: %0.4f, "
+                    "lower bound: %0.4f\n", exact_result.nodes,
+                    (float) search.best_score, exact_result.lower_bound);
+        }
+    }
+    for (int s = 0; s < n_slots; s++) {
+        place_tile(search.slots[s], tiles_by_id[search.best_tile_at[s]]);
+    }
+    evaluate_grid();
+}
@@ -0,0 +1,2982 @@
+#include <dirent.h>
+#include <sys/resource.h>
+#include <mutex>
+#include <condition_variable>
+
+#include "galaxy.hpp"
+
+const list<Planet>& Tile::get_planets()
+{
+    return planets;
+}
+
+
+string Tile::get_race()
+{
+    return race;
+}
+
+int Tile::get_resource_value()
+{
+    return resources;
+}
+
+int Tile::get_influence_value()
+{
+    return influence;
+}
+
+float Tile::get_res_inf_value()
+{
+    return res_inf;
+}
+
+int Tile::get_number() {
+    return number;
+}
+
+int Tile::get_id() {
+    return id;
+}
+
+void Tile::set_id(int i) {
+    id = i;
+}
+
+Anomaly Tile::get_anomaly() {
+    return anomaly;
+}
+
+TechColor Tile::get_techcolor() {
+   for (auto& p : planets) {
+       if (p.tech) {
+           return p.tech;
+       }
+   }
+   return NO_TECH;
+}
+
+Wormhole Tile::get_wormhole() {
+    return wormhole;
+}
+
+void Tile::set_location(Location l) {
+    location = l;
+}
+
+Location Tile::get_location() {
+    return location;
+}
+
+string Tile::get_description_string() const {
+    ostringstream desc;
+    desc << "Tile " << number << " - ";
+    for (auto it = planets.begin(); it != planets.end(); it++) {
+        if (it != planets.begin()) {
+            desc << ", ";
+        }
+        desc << it->name;
+    }
+
+    return desc.str();
+}
+
+bool Tile::is_home_system()
+{
+    return race.length();
+}
+
+std::ostream& operator<< (std::ostream &out, Tile const& tile) {
+    out << tile.get_description_string();
+    return out;
+}
+
+Tile::Tile(int n) : number(n), wormhole(NO_WORMHOLE), anomaly(NO_ANOMALY), race("") {};
+
+Tile::Tile(int n, string race) 
+    : number(n), wormhole(NO_WORMHOLE), anomaly(NO_ANOMALY), race(race) {};
+
+Tile::Tile(int n, list<Planet> p, Wormhole w, Anomaly a)
+{
+    number = n;
+    planets = p;
+    wormhole = w;
+    anomaly = a;
+    race = "";
+
+    resources = 0;
+    influence = 0;
+    res_inf = 0;
+    for (auto planet : planets) {
+        resources += planet.resources;
+        influence += planet.influence;
+        res_inf += max(1.0 * planet.resources, planet.influence * 0.667);
+    }
+}
+
+Tile::Tile(int n, list<Planet> p, string race1)
+{
+    number = n;
+    planets = p;
+    wormhole = NO_WORMHOLE;
+    anomaly = NO_ANOMALY;
+    race = race1;
+
+    resources = 0;
+    influence = 0;
+    res_inf = 0;
+    for (auto planet : planets) {
+        resources += planet.resources;
+        influence += planet.influence;
+        res_inf += max(1.0 * planet.resources, planet.influence * 0.667);
+    }
+}
+
+/* Cost of moving out of a tile in tenths of a move, negative if ships cannot
+ * move through it at all
+ */
+int get_move_cost(Tile* tile)
+{
+    switch (tile->get_anomaly()) {
+        case NEBULA: return 20;
+        case ASTEROID_FIELD: return 15;
+        case SUPERNOVA: return -1;
+        case GRAVITY_RIFT: return 10; 
+        case EMPTY: return 12; 
+        default : return 10;
+    }
+}
+
+static const char* stop_reason_names[] = {
+    "converged", "evaluation_limit", "time_limit", "deadline"
+};
+
+static const char* penalty_names[] = {
+    "home systems without planets (x10)", "adjacent home systems (x5)",
+    "adjacent anomalies (x1)", "adjacent wormholes (x2)",
+    "muaat does not have supernova (x10)", "cruess does not have wormhole (x10)",
+    "Saar do not have asteroids (x10)", 
+    "winnu does not have a clear path to mecatol (x10)"
+};
+
+static const char* stats_phase_names[] = {
+    "import", "initialize_grid", "distance_to_other_tiles", "calculate_stakes",
+    "calculate_shares", "penalties", "write_json"
+};
+
+void GeneratorStats::add(const GeneratorStats& other)
+{
+    for (int phase = 0; phase < N_STATS_PHASES; phase++) {
+        phase_ms[phase] += other.phase_ms[phase];
+    }
+    optimize_ms += other.optimize_ms;
+    evaluations += other.evaluations;
+    swaps_tried += other.swaps_tried;
+    swaps_accepted += other.swaps_accepted;
+    nodes_expanded += other.nodes_expanded;
+}
+
+json GeneratorStats::to_json() const
+{
+    json j;
+    for (int phase = 0; phase < N_STATS_PHASES; phase++) {
+        j["phases_ms"][stats_phase_names[phase]] = phase_ms[phase];
+    }
+    j["optimize_ms"] = optimize_ms;
+    j["evaluations"] = evaluations;
+    j["evaluations_per_second"] = optimize_ms ? evaluations * 1000 / optimize_ms : 0;
+    j["swaps_tried"] = swaps_tried;
+    j["swaps_accepted"] = swaps_accepted;
+    j["nodes_expanded"] = nodes_expanded;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    j["peak_rss_kb"] = usage.ru_maxrss;
+    return j;
+}
+
+SearchBudget::SearchBudget(long max_evaluations, int time_limit_ms, 
+        chrono::steady_clock::time_point deadline)
+    : start(chrono::steady_clock::now()), deadline(deadline), 
+    max_evaluations(max_evaluations), time_limit_ms(time_limit_ms) {};
+
+float SearchBudget::elapsed_ms()
+{
+    return elapsed;
+}
+
+/* Once a limit has been hit the budget stays exhausted, and stop_reason says
+ * which one it was
+ */
+bool SearchBudget::is_exhausted()
+{
+    if (stop_reason != CONVERGED) {
+        return true;
+    }
+    if (max_evaluations and n_evaluations >= max_evaluations) {
+        stop_reason = EVALUATION_LIMIT;
+    } else if (n_evaluations >= next_clock_check) {
+        next_clock_check = n_evaluations + CLOCK_CHECK_INTERVAL;
+        auto now = chrono::steady_clock::now();
+        elapsed = chrono::duration<float, milli>(now - start).count();
+        if (time_limit_ms and elapsed >= time_limit_ms) {
+            stop_reason = TIME_LIMIT;
+        } else if (now >= deadline) {
+            stop_reason = DEADLINE;
+        }
+    }
+    return stop_reason != CONVERGED;
+}
+
+/* A budget for one of n_shares searches that carry on side by side from
+ * this one. They keep its start, time limit and deadline, and split what is
+ * left of max_evaluations (0 for no limit) after this budget's evaluations
+ */
+SearchBudget SearchBudget::share(long max_evaluations, int n_shares)
+{
+    SearchBudget part = *this;
+    part.n_evaluations = 0;
+    part.next_clock_check = 0;
+    part.max_evaluations = 0;
+    if (stop_reason == EVALUATION_LIMIT) {
+        part.stop_reason = CONVERGED;
+    }
+    if (max_evaluations) {
+        long left = max_evaluations - n_evaluations;
+        if (left > 0) {
+            part.max_evaluations = MAX(left / n_shares, 1);
+        } else {
+            part.stop_reason = EVALUATION_LIMIT;
+        }
+    }
+    return part;
+}
+
+/* Fraction of whichever limit is closest to running out, between 0 and 1
+ */
+float SearchBudget::fraction_used()
+{
+    float fraction = 0;
+    if (max_evaluations) {
+        fraction = MAX(fraction, (float) n_evaluations / max_evaluations);
+    }
+    if (time_limit_ms) {
+        fraction = MAX(fraction, elapsed_ms() / time_limit_ms);
+    }
+    return MIN(fraction, 1);
+}
+
+Galaxy::Galaxy(string tile_filename, string layout_filename, int n_players, 
+        HomeSystemSetups hss, string home_tile_numbers, 
+        string mandatory_tile_numbers, bool star_by_star,
+        unsigned int seed, int restart)
+    : Galaxy(load_tiles(tile_filename), load_layout(layout_filename), n_players,
+            hss, home_tile_numbers, mandatory_tile_numbers, star_by_star, 
+            seed, restart) {};
+
+/* Home systems are chosen using only the seed, so every restart with the same
+ * seed plays the same races. The starting grid and the order swaps are tried
+ * in come from a separate random stream for each restart. Throws 
+ * invalid_argument if the layout cannot seat the players
+ */
+Galaxy::Galaxy(const TileSet& tile_set, const Layout& layout, int n_players, 
+        HomeSystemSetups hss, string home_tile_numbers, 
+        string mandatory_tile_numbers, bool star_by_star,
+        unsigned int seed, int restart)
+    : boundary_tile(0), rng(seed), restart(restart)
+{
+    if (not layout.player_setups.count(n_players)) {
+        throw invalid_argument("Layout does not support " 
+                + to_string(n_players) + " players");
+    }
+    import_tiles(tile_set);
+    auto info = import_layout(layout, n_players);
+    build_adjacency();
+    switch (hss) {
+        case DUMMY: 
+            dummy_home_tiles(n_players);
+            break;
+        case RANDOM_RACES:
+            random_home_tiles(n_players);
+            break;
+        case CHOSEN_RACES:
+            chosen_home_tiles(home_tile_numbers);
+    }
+    if ((int) home_systems.size() != n_players) {
+        throw invalid_argument("Need " + to_string(n_players) 
+                + " home systems, found " + to_string(home_systems.size()));
+    }
+
+    seed_seq restart_seed = {seed, (unsigned int) restart};
+    rng.seed(restart_seed);
+
+    // Only runs once, so it is always timed
+    auto start = chrono::steady_clock::now();
+    initialize_grid(info, mandatory_tile_numbers, star_by_star);
+    index_wormhole_systems();
+    stats.phase_ms[INITIALIZE_GRID_PHASE] += chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+    //for (auto i : tiles) {
+    //    cout << i << endl;
+    //}
+}
+
+/* Returns an independent copy of the galaxy, with its own tiles, that can be
+ * modified and evaluated on another thread
+ */
+Galaxy* Galaxy::clone() const
+{
+    Galaxy* copy = new Galaxy(*this);
+    copy->relink_tiles(*this);
+    return copy;
+}
+
+/* Points every tile pointer copied from original at this galaxy's own copy
+ * of the tile
+ */
+void Galaxy::relink_tiles(const Galaxy& original)
+{
+    tiles_by_id.clear();
+    for (auto& t : tiles) {
+        tiles_by_id.push_back(&t);
+    }
+
+    auto relink = [&](Tile* t) -> Tile* {
+        if (not t) {
+            return NULL;
+        }
+        if (t == &original.boundary_tile) {
+            return &boundary_tile;
+        }
+        return tiles_by_id[t->get_id()];
+    };
+
+    for (auto& t : grid) {
+        t = relink(t);
+    }
+    mecatol = relink(mecatol);
+    for (auto tile_list : {&movable_systems, &placed_tiles, &red_tiles, &blue_tiles}) {
+        for (auto& t : *tile_list) {
+            t = relink(t);
+        }
+    }
+    for (auto& t : home_systems) {
+        t = relink(t);
+    }
+    for (auto& wormhole_tiles : wormhole_systems) {
+        for (auto& t : wormhole_tiles) {
+            t = relink(t);
+        }
+    }
+    for (auto& t : small_bitboard.tiles) {
+        t = relink(t);
+    }
+    for (auto& t : large_bitboard.tiles) {
+        t = relink(t);
+    }
+    for (auto& t : pending_move.tiles) {
+        t = relink(t);
+    }
+}
+
+void Galaxy::place_tile(Location l, Tile* tile) 
+{
+    if (tile) {
+        tile->set_location(l);
+    }
+    grid[get_cell_index(l)] = tile;
+
+    // Keep the bitboard in use up to date
+    if (cell_slots.size()) {
+        int slot = cell_slots[get_cell_index(l)];
+        if (n_slots <= 64) {
+            small_bitboard.place(slot, tile);
+        } else if (n_slots <= 128) {
+            large_bitboard.place(slot, tile);
+        }
+    }
+}
+
+Planet create_planet_from_json(json j)
+{
+    Planet new_planet;
+
+    new_planet.name = j["name"];
+    new_planet.resources = j["resources"];
+    new_planet.influence = j["influence"];
+
+    new_planet.trait = trait_key.at(j["trait"]);
+    new_planet.tech = tech_key.at(j["tech"]);
+
+    return new_planet;
+}
+
+Tile create_tile_from_json(json j)
+{
+    int number = j["number"];
+    Wormhole wormhole = wormhole_key.at(j["wormhole"]);
+    Anomaly anomaly = anomaly_key.at(j["anomaly"]);
+
+    // Create planet list
+    json planet_list = j["planets"];
+    list<Planet> planets;
+    for (json::iterator it = planet_list.begin(); it != planet_list.end(); it++) {
+        planets.push_back(create_planet_from_json(it.value()));
+    }
+
+    if (j.find("race") != j.end()) {
+        string race = j["race"];
+        return Tile(number, planets, race);
+    } else {
+        return Tile(number, planets, wormhole, anomaly);
+    }
+}
+
+/* Takes ownership of a tile and gives it the next free tile id
+ */
+Tile* Galaxy::add_tile(Tile tile)
+{
+    tile.set_id(tiles.size());
+    tiles.push_back(tile);
+    tiles_by_id.push_back(&tiles.back());
+    tile_attributes.add(tiles.back());
+    return &tiles.back();
+}
+
+/* Appends the attributes of the tile with the next id
+ */
+void TileAttributes::add(Tile& tile)
+{
+    resources.push_back(tile.get_resource_value());
+    influence.push_back(tile.get_influence_value());
+    res_inf.push_back(tile.get_res_inf_value());
+    has_tech.push_back(tile.get_techcolor() ? 1 : 0);
+    for (auto& counts : trait_counts) {
+        counts.push_back(0);
+    }
+    for (auto& planet : tile.get_planets()) {
+        trait_counts[planet.trait].back()++;
+    }
+    is_home_system.push_back(tile.is_home_system());
+
+    float row[SHARE_COLUMNS] = {};
+    row[RESOURCE_SHARE] = resources.back();
+    row[INFLUENCE_SHARE] = influence.back();
+    row[RES_INF_SHARE] = res_inf.back();
+    row[TECH_SHARE] = has_tech.back();
+    share_rows.insert(share_rows.end(), row, row + SHARE_COLUMNS);
+}
+
+/* 64 bit FNV-1a hash. Good at telling contents apart, but not meant to 
+ * resist deliberate collisions
+ */
+uint64_t fnv1a_hash(const char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Hash of data as 16 hex digits, used to identify the contents of tile and
+ * layout files
+ */
+string content_digest(const string& data)
+{
+    uint64_t hash = fnv1a_hash(data.data(), data.size());
+    char digest[17];
+    snprintf(digest, sizeof(digest), "%016llx", (unsigned long long) hash);
+    return digest;
+}
+
+/* Parses a json file, keeping the digest of its contents
+ */
+json read_json_file(string filename, string& digest)
+{
+    ifstream json_file(filename);
+    stringstream contents;
+    contents << json_file.rdbuf();
+    digest = content_digest(contents.str());
+    try {
+        return json::parse(contents.str());
+    } catch (...) {
+        cerr << "Error loading/parsing " << filename << endl;
+        exit(-1);
+    }
+}
+
+TileSet load_tiles(string tile_filename)
+{
+    TileSet tile_set;
+    cerr << "Importing tiles from " << tile_filename << endl;
+    json tile_json = read_json_file(tile_filename, tile_set.digest);
+
+    // Create list of tiles
+    json tile_list = tile_json["red_tiles"];
+    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
+        tile_set.red_tiles.push_back(create_tile_from_json(it.value()));
+    }
+    tile_list = tile_json["blue_tiles"];
+    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
+        tile_set.blue_tiles.push_back(create_tile_from_json(it.value()));
+    }
+    // Also home tiles
+    tile_list = tile_json["home_tiles"];
+    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
+        tile_set.home_tiles.push_back(create_tile_from_json(it.value()));
+    }
+    tile_set.mecatol = create_tile_from_json(tile_json["mecatol"]);
+
+    cerr << "Loaded " << tile_set.red_tiles.size() + tile_set.blue_tiles.size()
+        + tile_set.home_tiles.size() + 1 << " tiles" << endl;
+    cerr << "\tblue: " << tile_set.blue_tiles.size() << " " << endl;
+    cerr << "\tred:" << tile_set.red_tiles.size() << " tiles" << endl;
+    return tile_set;
+}
+
+void Galaxy::import_tiles(const TileSet& tile_set)
+{
+    for (auto& tile : tile_set.red_tiles) {
+        red_tiles.push_back(add_tile(tile));
+    }
+    for (auto& tile : tile_set.blue_tiles) {
+        blue_tiles.push_back(add_tile(tile));
+    }
+    for (auto& tile : tile_set.home_tiles) {
+        home_systems.push_back(add_tile(tile));
+    }
+    
+    // Save a pointer to mecatol rex
+    mecatol = add_tile(tile_set.mecatol);
+}
+
+list<Tile*> get_tile_pointers(list<Tile*> tiles, string numbers)
+{
+    list<int> n_list;
+    stringstream chosen_ss(numbers);
+    int n;
+    while (chosen_ss >> n) {
+        cerr << "using number " << n << endl;
+        n_list.push_back(n);
+    }
+    
+    list<Tile*> matching_tiles;
+    for (auto t : tiles) {
+        if (find(n_list.begin(), n_list.end(), t->get_number()) != n_list.end()) {
+            matching_tiles.push_back(t);
+        }
+    }
+
+    return matching_tiles;
+}
+
+Tile * Galaxy::get_tile_by_number(int n) {
+    for (auto it = tiles.begin(); it != tiles.end(); it++) {
+        if (it->get_number() == n) {
+            return &*it;
+        }
+    }
+    throw domain_error("No tile with requested number found");
+}
+
+
+Layout load_layout(string layout_filename)
+{
+    Layout layout;
+    cerr << "Importing layout from " << layout_filename << endl;
+    json layout_json = read_json_file(layout_filename, layout.digest);
+
+    for (auto l : layout_json["valid_locations"]) {
+        int i = l.at(0);
+        int j = l.at(1);
+        layout.valid_locations.push_back({i, j});
+    }
+
+    for (json::iterator it = layout_json["fixed_tiles"].begin(); it != layout_json["fixed_tiles"].end(); ++it) {
+        int i = it.value().at(0);
+        int j = it.value().at(1);
+        layout.fixed_tiles.push_back({stoi(it.key()), {i, j}});
+    }
+
+    for (json::iterator it = layout_json["home_tile_positions"].begin(); 
+            it != layout_json["home_tile_positions"].end(); ++it) {
+        struct layout_info info;
+        for (auto l : it.value()) {
+            int i = l.at(0);
+            int j = l.at(1);
+            info.start_positions.push_back({i, j});
+        }
+        info.n_blue = layout_json["movable_tile_counts"][it.key()]["blue"];
+        info.n_red = layout_json["movable_tile_counts"][it.key()]["red"];
+        layout.player_setups[stoi(it.key())] = info;
+    }
+
+    if (layout_json.find("warp_connections") != layout_json.end()) {
+        for (auto & j_connection : layout_json["warp_connections"]) {
+            vector<Location> warp_connection(2);
+            warp_connection[0].i = j_connection[0][0];
+            warp_connection[0].j = j_connection[0][1];
+            warp_connection[1].i = j_connection[1][0];
+            warp_connection[1].j = j_connection[1][1];
+            layout.warp_connections.push_back(warp_connection);
+        }
+    }
+    return layout;
+}
+
+/* Paths of the layout files in a directory, sorted by name
+ */
+vector<string> list_layouts(string directory)
+{
+    vector<string> layouts;
+    DIR* dir = opendir(directory.c_str());
+    if (not dir) {
+        cerr << "Could not open layout directory " << directory << endl;
+        exit(-1);
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.size() > 5 and name.substr(name.size() - 5) == ".json") {
+            layouts.push_back(directory + "/" + name);
+        }
+    }
+    closedir(dir);
+    sort(layouts.begin(), layouts.end());
+    return layouts;
+}
+
+struct layout_info Galaxy::import_layout(const Layout& layout, int n_players)
+{
+    int max_i = 0;
+    int max_j = 0;
+    for (auto l : layout.valid_locations) {
+        max_i = l.i > max_i ? l.i : max_i;
+        max_j = l.j > max_j ? l.j : max_j;
+    }
+
+    grid_rows = max_i + 1;
+    grid_columns = max_j + 1;
+    grid.assign((grid_rows + 2) * (grid_columns + 2), &boundary_tile);
+
+    for (auto l : layout.valid_locations) {
+        place_tile(l, NULL);
+    }
+
+    for (auto& fixed_tile : layout.fixed_tiles) {
+        Tile* t = get_tile_by_number(fixed_tile.first);
+        place_tile(fixed_tile.second, t);
+        red_tiles.remove(t);
+        blue_tiles.remove(t);
+        placed_tiles.push_back(t);
+    }
+
+    warp_connections = layout.warp_connections;
+    return layout.player_setups.at(n_players);
+}
+
+list<Tile*> get_shuffled_list(list<Tile*> l, mt19937& rng)
+{
+    vector<Tile *> to_shuffle;
+    list<Tile *> ret;
+    for (auto it : l) {
+        to_shuffle.push_back(it);
+    }
+    shuffle(to_shuffle.begin(), to_shuffle.end(), rng);
+    for (auto it : to_shuffle) {
+        ret.push_back(it);
+    }
+    return ret;
+}
+
+void Galaxy::random_home_tiles(int n) {
+    auto shuffled = get_shuffled_list(
+            list<Tile*>(home_systems.begin(), home_systems.end()), rng);
+    auto it = shuffled.begin();
+    home_systems.clear();
+    list<Tile*> new_home_tiles;
+    for (int i = 0; i < n; i++) {
+        home_systems.push_back(*it);
+        it++;
+    }
+}
+
+void Galaxy::chosen_home_tiles(string chosen) {
+
+    list<Tile*> available_home_systems;
+    available_home_systems = get_tile_pointers(
+            list<Tile*>(home_systems.begin(), home_systems.end()), chosen);
+    home_systems.assign(available_home_systems.begin(), available_home_systems.end());
+}
+
+void Galaxy::dummy_home_tiles(int n) {
+    home_systems.clear();
+    for (int i = 0; i < n; i++) {
+        Tile new_tile = Tile(-i - 1, "Home System " + to_string(i + 1));
+        home_systems.push_back(add_tile(new_tile));
+    }
+}
+
+void Galaxy::initialize_grid(struct layout_info layout_info, string mandatory_tile_numbers, bool star_by_star) {
+
+    // Place home systems (Star by star means that home systems can be anywhere)
+    if (not star_by_star) {
+        auto sp_it = layout_info.start_positions.begin();
+        for (auto hs : get_shuffled_list(
+                    list<Tile*>(home_systems.begin(), home_systems.end()), rng)) {
+            place_tile(*sp_it, hs);
+            sp_it++;
+            placed_tiles.push_back(hs);
+        }
+    }
+
+    // Collect tiles to randomly place later as the inital galaxy setup, starting 
+    // with mandatory tiles
+    list<Tile*> random_tiles;
+    list<Tile*> tmp;
+    tmp = get_tile_pointers(blue_tiles, mandatory_tile_numbers);
+    layout_info.n_blue -= tmp.size();
+    random_tiles = tmp;
+
+    tmp = get_tile_pointers(red_tiles, mandatory_tile_numbers);
+    layout_info.n_red -= tmp.size();
+    random_tiles.insert(random_tiles.end(), tmp.begin(), tmp.end());
+
+    // Also home systems if playing star by star
+    if (star_by_star) {
+        random_tiles.insert(random_tiles.end(), home_systems.begin(), home_systems.end());
+    }
+
+    // Then just get the rest of the needed tiles
+    for (auto s : get_shuffled_list(blue_tiles, rng)) {
+        if (find(random_tiles.begin(), random_tiles.end(), s) == random_tiles.end()) {
+            random_tiles.push_back(s);
+            layout_info.n_blue--;
+            if (not layout_info.n_blue) {
+                break;
+            }
+        }
+    }
+
+    for (auto s : get_shuffled_list(red_tiles, rng)) {
+        if (find(random_tiles.begin(), random_tiles.end(), s) == random_tiles.end()) {
+            random_tiles.push_back(s);
+            layout_info.n_red--;
+            if (not layout_info.n_red) {
+                break;
+            }
+        }
+    }
+
+    // Shuffle the tiles to be placed and place them in the grid
+    // Any tiles placed this way are also movable tiles
+    random_tiles = get_shuffled_list(random_tiles, rng);
+    movable_systems.clear();
+    for (int i = 0; i < grid_rows; i++) {
+        for (int j = 0; j < grid_columns; j++) {
+            if (not grid[get_cell_index({i, j})]) {
+                place_tile({i, j}, random_tiles.front());
+                movable_systems.push_back(random_tiles.front());
+                random_tiles.pop_front();
+            }
+        }
+    }
+
+    placed_tiles.insert(placed_tiles.begin(), 
+            movable_systems.begin(), movable_systems.end());
+}
+
+
+void Galaxy::print_grid() {
+    for (int i = 0; i < grid_rows; i++) {
+        for (int i_pad = 0; i_pad < grid_rows - i; i_pad++) {
+            cout << "  ";
+        }
+        for (int j = 0; j < grid_columns; j++) {
+            Tile* tile = grid[get_cell_index({i, j})];
+            if (tile and tile != &boundary_tile) {
+                printf(" %02d ", tile->get_number());
+            } else {
+                cout << "    ";
+            }
+        }
+        cout << endl << endl;
+    }
+}
+
+Tile* Galaxy::get_tile_at(Location l) {
+    if (l.i < 0 or l.i >= grid_rows or l.j < 0 or l.j >= grid_columns) {
+        return NULL;
+    }
+    Tile * tile = grid[get_cell_index(l)];
+    if (tile == &boundary_tile) {
+        return NULL;
+    }
+    return tile;
+}
+
+bool Galaxy::is_valid_location(Location l) {
+    return l.i >= 0 and l.i < grid_rows and l.j >= 0 and l.j < grid_columns
+        and grid[get_cell_index(l)] != &boundary_tile;
+}
+
+/* Index of a location in grid. Locations one step outside the layout are
+ * still valid indices, of border cells
+ */
+int Galaxy::get_cell_index(Location l) {
+    return (l.i + 1) * (grid_columns + 2) + l.j + 1;
+}
+
+/* Builds the adjacency between every valid location in the layout, that is
+ * the six hex neighbours plus any warp lanes
+ */
+void Galaxy::build_adjacency()
+{
+    const int stride = grid_columns + 2;
+    const int hex_offsets[] = {1, stride + 1, stride, -1, -stride - 1, -stride};
+
+    adjacency_offsets.clear();
+    adjacent_cells.clear();
+    cell_slots.clear();
+    n_slots = 0;
+    for (int cell = 0; cell < (int) grid.size(); cell++) {
+        adjacency_offsets.push_back(adjacent_cells.size());
+        if (grid[cell] == &boundary_tile) {
+            cell_slots.push_back(-1);
+            continue;
+        }
+        cell_slots.push_back(n_slots++);
+
+        // Cells in the layout never lie on the border, so all six neighbours
+        // are inside the grid
+        vector<int> adjacent;
+        for (int offset : hex_offsets) {
+            adjacent.push_back(cell + offset);
+        }
+        Location location = {cell / stride - 1, cell % stride - 1};
+        for (auto warp_connection : warp_connections) {
+            if (warp_connection[0] == location 
+                    and is_valid_location(warp_connection[1])) {
+                adjacent.push_back(get_cell_index(warp_connection[1]));
+            } else if (warp_connection[1] == location
+                    and is_valid_location(warp_connection[0])) {
+                adjacent.push_back(get_cell_index(warp_connection[0]));
+            }
+        }
+
+        // Only keep unique cells that are part of the galaxy
+        for (auto it = adjacent.begin(); it != adjacent.end(); it++) {
+            if (grid[*it] != &boundary_tile 
+                    and find(adjacent.begin(), it, *it) == it) {
+                adjacent_cells.push_back(*it);
+            }
+        }
+    }
+    adjacency_offsets.push_back(adjacent_cells.size());
+
+    if (n_slots <= 64) {
+        build_bitboard(small_bitboard);
+    } else if (n_slots <= 128) {
+        build_bitboard(large_bitboard);
+    }
+}
+
+/* Fills in the neighbour masks of a bitboard from the adjacency and records
+ * the tiles already placed
+ */
+template <class Mask>
+void Galaxy::build_bitboard(Bitboard<Mask>& bitboard)
+{
+    bitboard.resize(n_slots);
+    for (int cell = 0; cell < (int) cell_slots.size(); cell++) {
+        int slot = cell_slots[cell];
+        if (slot < 0) {
+            continue;
+        }
+        for (int k = adjacency_offsets[cell]; k < adjacency_offsets[cell + 1]; k++) {
+            bitboard.neighbours[slot] |= (Mask) 1 << cell_slots[adjacent_cells[k]];
+        }
+        bitboard.place(slot, grid[cell]);
+    }
+}
+
+/* Records which of the placed tiles have wormholes. Tiles left out of the 
+ * galaxy must not connect to anything, and swaps never change which tiles
+ * are placed
+ */
+void Galaxy::index_wormhole_systems()
+{
+    wormhole_systems.assign(DELTA + 1, vector<Tile*>());
+    for (auto t : placed_tiles) {
+        if (t->get_wormhole()) {
+            wormhole_systems[t->get_wormhole()].push_back(t);
+        }
+    }
+}
+
+/* Calls visit with each tile get_adjacent would return, in the same order,
+ * without building a vector. Used by the scoring loops
+ */
+template <class Visit>
+void Galaxy::for_each_adjacent(Tile* t1, bool go_through_wormholes, Visit visit)
+{
+    // Tiles directly adjecent or connected by warp lanes
+    int cell = get_cell_index(t1->get_location());
+    int begin = adjacency_offsets[cell];
+    int end = adjacency_offsets[cell + 1];
+    for (int k = begin; k < end; k++) {
+        if (grid[adjacent_cells[k]]) {
+            visit(grid[adjacent_cells[k]]);
+        }
+    }
+
+    // Connected wormholes, skipping tiles that are already adjacent
+    if (go_through_wormholes and t1->get_wormhole()) {
+        for (Tile* t : wormhole_systems[t1->get_wormhole()]) {
+            bool adjacent = t == t1;
+            for (int k = begin; k < end and not adjacent; k++) {
+                adjacent = grid[adjacent_cells[k]] == t;
+            }
+            if (not adjacent) {
+                visit(t);
+            }
+        }
+    }
+}
+
+vector<Tile*> Galaxy::get_adjacent(Tile *t1, bool go_through_wormholes)
+{
+    vector<Tile*> adjacent;
+    for_each_adjacent(t1, go_through_wormholes, [&](Tile* t) {
+        adjacent.push_back(t);
+    });
+    return adjacent;
+}
+
+/* Fills distances (indexed by tile id) with the cost of the shortest path from
+ * t1 to every tile, or UNREACHABLE if there is no path. Galaxies that fit in
+ * a bitboard use it, larger ones dial_distances
+ */
+void Galaxy::distance_to_other_tiles(Tile* t1, float* distances) {
+    PhaseTimer timer(stats, DISTANCES_PHASE);
+    if (n_slots <= 64) {
+        bitboard_distances(small_bitboard, t1, distances);
+    } else if (n_slots <= 128) {
+        bitboard_distances(large_bitboard, t1, distances);
+    } else {
+        dial_distances(t1, distances);
+    }
+}
+
+/* Same as distance_to_other_tiles, for any size of galaxy
+ *
+ * This is Dial's algorithm: tiles waiting to be visited are kept in a circular
+ * array of buckets, one per integer path length, so every tile is settled 
+ * exactly once in order of distance. No move costs more than MAX_MOVE_COST, so
+ * MAX_MOVE_COST + 1 buckets are enough
+ */
+void Galaxy::dial_distances(Tile* t1, float* distances) {
+    fill(distances, distances + tiles_by_id.size(), UNREACHABLE);
+
+    const int n_buckets = MAX_MOVE_COST + 1;
+    path_lengths.assign(tiles_by_id.size(), INT_MAX);
+    distance_buckets.resize(n_buckets);
+    for (auto& bucket : distance_buckets) {
+        bucket.clear();
+    }
+
+    path_lengths[t1->get_id()] = 0;
+    distance_buckets[0].push_back(t1->get_id());
+    int n_waiting = 1;
+
+    for (int length = 0; n_waiting; length++) {
+        vector<int>& bucket = distance_buckets[length % n_buckets];
+        while (bucket.size()) {
+            int id = bucket.back();
+            bucket.pop_back();
+            n_waiting--;
+
+            // Skip tiles that were since reached by a shorter path
+            if (path_lengths[id] != length) {
+                continue;
+            }
+            distances[id] = (float) length / MOVE_COST_SCALE;
+            stats.nodes_expanded++;
+
+            Tile* cur_tile = tiles_by_id[id];
+            int move_cost = get_move_cost(cur_tile);
+            if (move_cost < 0) {
+                continue;
+            }
+
+            auto visit = [&](Tile* adjacent) {
+                // Home systems other than the start system block movement
+                // and are never given a distance
+                if (adjacent->is_home_system()) {
+                    return;
+                }
+                int adjacent_id = adjacent->get_id();
+                if (path_lengths[adjacent_id] > length + move_cost) {
+                    path_lengths[adjacent_id] = length + move_cost;
+                    distance_buckets[(length + move_cost) % n_buckets].push_back(adjacent_id);
+                    n_waiting++;
+                }
+            };
+
+            int cell = get_cell_index(cur_tile->get_location());
+            for (int k = adjacency_offsets[cell]; k < adjacency_offsets[cell + 1]; k++) {
+                visit(grid[adjacent_cells[k]]);
+            }
+            if (cur_tile->get_wormhole()) {
+                for (Tile* t : wormhole_systems[cur_tile->get_wormhole()]) {
+                    visit(t);
+                }
+            }
+        }
+    }
+}
+
+/* Same as dial_distances, but works on whole sets of locations at 
+ * once. Every location reached at the current path length is settled in one 
+ * step, and the locations that can be reached from them are found by OR-ing
+ * together neighbour masks, separately for each move cost
+ */
+template <class Mask>
+void Galaxy::bitboard_distances(Bitboard<Mask>& bitboard, Tile* t1, 
+        float* distances)
+{
+    fill(distances, distances + tiles_by_id.size(), UNREACHABLE);
+
+    const int n_buckets = MAX_MOVE_COST + 1;
+    Mask waiting[n_buckets] = {};
+    Mask settled = 0;
+
+    int start_slot = cell_slots[get_cell_index(t1->get_location())];
+    waiting[0] = (Mask) 1 << start_slot;
+    int max_length = 0;
+    long n_expanded = 0;
+
+    for (int length = 0; length <= max_length; length++) {
+        Mask layer = waiting[length % n_buckets] & ~settled;
+        waiting[length % n_buckets] = 0;
+        if (not layer) {
+            continue;
+        }
+        settled |= layer;
+        for (Mask m = layer; m; m &= m - 1) {
+            Tile* tile = bitboard.tiles[lowest_bit(m)];
+            distances[tile->get_id()] = (float) length / MOVE_COST_SCALE;
+            n_expanded++;
+        }
+
+        // Supernovas are in none of the move cost masks so nothing leaves them
+        for (int cost = 1; cost <= MAX_MOVE_COST; cost++) {
+            Mask from = layer & bitboard.move_cost[cost];
+            if (not from) {
+                continue;
+            }
+            Mask reached = 0;
+            for (Mask m = from; m; m &= m - 1) {
+                reached |= bitboard.neighbours[lowest_bit(m)];
+            }
+            for (int w = ALPHA; w <= DELTA; w++) {
+                if (from & bitboard.wormholes[w]) {
+                    reached |= bitboard.wormholes[w];
+                }
+            }
+            // Home systems other than the start system block movement
+            reached &= ~settled & ~bitboard.home_systems;
+            if (reached) {
+                waiting[(length + cost) % n_buckets] |= reached;
+                max_length = MAX(max_length, length + cost);
+            }
+        }
+    }
+    stats.nodes_expanded += n_expanded;
+}
+
+/* Splits the value of a single system between the home systems according to
+ * their distance to it, and stores the result in the tile's column of stakes. 
+ * Nobody has a stake in systems that are worthless or out of reach
+ */
+void Galaxy::calculate_tile_stakes(Tile* t, const TileMatrix& distances, 
+        TileMatrix& stakes)
+{
+    int id = t->get_id();
+    int n_home_systems = home_systems.size();
+
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        stakes[hs][id] = 0;
+    }
+
+    // Other races have no stakes in each-other's home systems
+    if (t->is_home_system()) {
+        return;
+    }
+
+    // Skip systems with nothing of value in them
+    if (not (tile_attributes.resources[id] or tile_attributes.influence[id] 
+                or tile_attributes.has_tech[id])) {
+        return;
+    }
+    split_stake(id, t != mecatol, distances, stakes);
+}
+
+/* Splits a system with something of value in it between the home systems,
+ * from its distances to them in distances[hs][id]. Sets stakes[hs][id] for
+ * every home system. Only systems other than mecatol rex may be given to 
+ * the home systems closest to them with pie slice assignment
+ */
+void Galaxy::split_stake(int id, bool may_pie_slice, const TileMatrix& distances,
+        TileMatrix& stakes)
+{
+    int n_home_systems = home_systems.size();
+
+    // Systems like supernovas will not have any path to them, and unreachable
+    // distances give them no stake at all
+    float min_dist = 1000;
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        if (distances[hs][id] < min_dist) {
+            min_dist = distances[hs][id];
+        }
+    }
+
+    float total_stake = 0;
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        float stake;
+        if (min_dist < 3 
+                and evaluation_config.pie_slice_assignment
+                and may_pie_slice) {
+            // Systems close to home systems will be assigned entirely
+            // to those close home systems
+            // Never do this for mecatol rex
+            stake = distances[hs][id] == min_dist ? 1 : 0;
+        } else {
+            // Systems far away will b split according to inverse distance ^ 2
+            stake = 1.0 / pow(distances[hs][id], 2);
+        }
+        stakes[hs][id] = stake;
+        total_stake += stake;
+    }
+    if (total_stake == 0) {
+        return;
+    }
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        stakes[hs][id] /= total_stake;
+    }
+}
+
+void Galaxy::calculate_stakes(const TileMatrix& distances, TileMatrix& stakes)
+{
+    PhaseTimer timer(stats, STAKES_PHASE);
+    stakes.resize(home_systems.size(), tiles_by_id.size());
+    fill(stakes.values.begin(), stakes.values.end(), 0);
+    for (auto t : placed_tiles) {
+        calculate_tile_stakes(t, distances, stakes);
+    }
+}
+
+float average(const float* values, int n) 
+{
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += values[i];
+    }
+    return sum / n;
+}
+
+float coefficient_of_variation(const float* values, int n) {
+    float sum = 0;
+    float avg = average(values, n);
+    for (int i = 0; i < n; i++) {
+        sum += pow(values[i] - avg, 2);
+    }
+    // Nothing to share out is shared perfectly evenly
+    if (avg == 0) {
+        return 0;
+    }
+    return sum / n / avg;
+}
+
+float coefficient_of_variation(const vector<float>& values) {
+    return coefficient_of_variation(values.data(), values.size());
+}
+
+/* Returns the index of the home system with the given tile number, or -1 if
+ * that race is not in this game
+ */
+int Galaxy::get_home_system_index(int tile_number)
+{
+    for (int i = 0; i < (int) home_systems.size(); i++) {
+        if (home_systems[i]->get_number() == tile_number) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Returns true if there exists a supernova tile with a distance to the muaat
+ * home system less than or equal to near_dist
+ */
+bool Galaxy::is_supernova_near_muaat(int near_dist, const TileMatrix& distances)
+{
+    // Check to see if muaat is in this game
+    int muaat_tile_number = 4;
+    int muaat = get_home_system_index(muaat_tile_number);
+    // No penalty if muaat are not in this game
+    if (muaat < 0) {
+        return 0;
+    }
+
+    for (auto t : placed_tiles) {
+        if (t->get_anomaly() == SUPERNOVA) {
+            if (distances[muaat][t->get_id()] <= near_dist) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Returns true if there exists a wormhole tile with a distane to the creuss
+ * home system less than or equal to near_dist
+ */
+bool Galaxy::winnu_have_clear_path_to_mecatol(const TileMatrix& distances)
+{
+    // Check to see if Winnu is in this game
+    int winnu_tile_number = 7;
+    int winnu = get_home_system_index(winnu_tile_number);
+    // No penalty if winnu are not in this game
+    if (winnu < 0) {
+        return 0;
+    }
+
+    if (distances[winnu][mecatol->get_id()] <= 3) {
+        return true;
+    }
+    return false;
+}
+
+/* Returns true if there is a clear path for winnu to mecatol
+ */
+bool Galaxy::is_wormhole_near_creuss(int near_dist, const TileMatrix& distances)
+{
+    // Check to see if winnu is in this game
+    int creuss_tile_number = 17;
+    int creuss = get_home_system_index(creuss_tile_number);
+    // No penalty if creuss are not in this game
+    if (creuss < 0) {
+        return 0;
+    }
+
+    for (auto t : placed_tiles) {
+        if (t->get_wormhole() and t->get_wormhole() != DELTA) {
+            if (distances[creuss][t->get_id()] <= near_dist) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool Galaxy::is_asteroid_near_saar(int near_dist, const TileMatrix& distances)
+{
+    // Check to see if saar is in this game
+    int saar_tile_number = 11;
+    int saar = get_home_system_index(saar_tile_number);
+    // No penalty if saar are not in this game
+    if (saar < 0) {
+        return 0;
+    }
+
+    for (auto t : placed_tiles) {
+        if (t->get_anomaly() == ASTEROID_FIELD) {
+            if (distances[saar][t->get_id()] <= near_dist) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Sets an option by the name it has on the command line. Unknown names are
+ * rejected rather than silently ignored
+ */
+void EvaluationConfig::set(string name, float value)
+{
+    if (evaluation_distance_key.count(name)) {
+        this->*evaluation_distance_key[name] = value;
+    } else if (evaluation_weight_key.count(name)) {
+        this->*evaluation_weight_key[name] = value;
+    } else if (name == "ring_balance") {
+        ring_balance = value;
+    } else if (name == "pie_slice_assignment") {
+        pie_slice_assignment = value;
+    } else {
+        throw invalid_argument("Unknown evaluate option " + name);
+    }
+}
+
+void EvaluationConfig::validate() const
+{
+    for (auto& key : evaluation_distance_key) {
+        if (this->*key.second < 0) {
+            throw invalid_argument(key.first + " must not be negative");
+        }
+    }
+    for (auto& key : evaluation_weight_key) {
+        if (not isfinite(this->*key.second) or this->*key.second < 0) {
+            throw invalid_argument(key.first + " must be a non negative number");
+        }
+    }
+    if (not isfinite(ring_balance) or ring_balance < 0) {
+        throw invalid_argument("ring_balance must be a non negative number");
+    }
+}
+
+json EvaluationConfig::to_json() const
+{
+    json j;
+    for (auto& key : evaluation_distance_key) {
+        j[key.first] = this->*key.second;
+    }
+    for (auto& key : evaluation_weight_key) {
+        j[key.first] = this->*key.second;
+    }
+    j["ring_balance"] = ring_balance;
+    j["pie_slice_assignment"] = pie_slice_assignment;
+    return j;
+}
+
+void Galaxy::set_evaluation_config(const EvaluationConfig& config)
+{
+    evaluation_config = config;
+}
+
+void Galaxy::print_distances_from(int tile_num)
+{
+    Tile* home_tile = NULL;
+    for (auto hs : home_systems) {
+        if (hs->get_number() == tile_num) {
+            home_tile = hs;
+        }
+    }
+    if (not home_tile) {
+        cout << "TIle not found" << endl;
+    }
+
+    vector<float> dists(tiles_by_id.size());
+    distance_to_other_tiles(home_tile, dists.data());
+    cout << "Distance from tile " << home_tile->get_number() << " to tile:" << endl;
+    for (auto t : tiles_by_id) {
+        if (dists[t->get_id()] != UNREACHABLE) {
+            cout << "\t" << t->get_number() << " " << dists[t->get_id()] << endl;
+        }
+    }
+}
+
+int Galaxy::count_home_systems_without_planets()
+{
+    int count = 0;
+    for (auto t : home_systems) {
+        int n_planet_tiles_adjacent = 0;
+        for_each_adjacent(t, true, [&](Tile* a) {
+            int id = a->get_id();
+            if (tile_attributes.resources[id] or tile_attributes.influence[id]) {
+                n_planet_tiles_adjacent++;
+            }
+        });
+        if (not n_planet_tiles_adjacent) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int Galaxy::count_adjacent_home_systems()
+{
+    int count = 0;
+    for (auto t : home_systems) {
+        for_each_adjacent(t, true, [&](Tile* a) {
+            if (a->is_home_system()) {
+                count++;
+            }
+        });
+    }
+    return count;
+}
+
+int Galaxy::count_adjacent_anomalies()
+{
+    int count = 0;
+    for (auto t : placed_tiles) {
+        if (t->get_anomaly() and t->get_anomaly() != EMPTY) {
+            for_each_adjacent(t, true, [&](Tile* a) {
+                if (a->get_anomaly() and a->get_anomaly() != EMPTY) {
+                    count++;
+                }
+            });
+        }
+    }
+    return count;
+}
+
+int Galaxy::count_adjacent_wormholes()
+{
+    int count = 0;
+    for (auto t : placed_tiles) {
+        if (t->get_wormhole()) {
+            for_each_adjacent(t, false, [&](Tile* a) {
+                if (t->get_wormhole() == a->get_wormhole()) {
+                    count++;
+                }
+            });
+        }
+    }
+    return count;
+}
+
+float Galaxy::first_turn_variance(const TileMatrix& stakes, Scores& scores)
+{
+    scores.first_turn_share.resize(home_systems.size());
+    for (int hs = 0; hs < (int) home_systems.size(); hs++) {
+        // Keep the best two systems next to the home system. No res_inf or
+        // stake is below 0
+        float best = 0;
+        float second = 0;
+        for_each_adjacent(home_systems[hs], true, [&](Tile* tile) {
+            int id = tile->get_id();
+            float res_inf = tile_attributes.res_inf[id] * stakes[hs][id];
+            if (res_inf > best) {
+                second = best;
+                best = res_inf;
+            } else if (res_inf > second) {
+                second = res_inf;
+            }
+        });
+        scores.first_turn_share[hs] = best + second;
+    }
+    return coefficient_of_variation(scores.first_turn_share);
+}
+
+/* Fills in every share of every home system in one pass over the stakes. 
+ * Tiles nobody has a stake in contribute nothing, so this can simply run 
+ * along each home system's row of stakes
+ */
+void Galaxy::calculate_shares(const TileMatrix& stakes, Scores& scores)
+{
+    PhaseTimer timer(stats, SHARES_PHASE);
+    float* shares[N_SHARE_KINDS];
+    for (int k = 0; k < N_SHARE_KINDS; k++) {
+        scores.shares[k].resize(stakes.n_rows);
+        shares[k] = scores.shares[k].data();
+    }
+    share_kernel(tile_attributes.share_rows.data(), stakes.values.data(), 
+            stakes.n_cols, stakes.n_cols, stakes.n_rows, shares, N_SHARE_KINDS);
+}
+
+float Galaxy::apply_penalties(const TileMatrix& distances)
+{
+    PhaseTimer timer(stats, PENALTIES_PHASE);
+    float* penalties = scores.penalties;
+
+    penalties[HOMES_WITHOUT_PLANETS_PENALTY] = count_home_systems_without_planets() * 10;
+    penalties[ADJACENT_HOMES_PENALTY] = count_adjacent_home_systems() * 5;
+    penalties[ADJACENT_ANOMALIES_PENALTY] = count_adjacent_anomalies();
+    penalties[ADJACENT_WORMHOLES_PENALTY] = count_adjacent_wormholes() * 2;
+
+    // Some race specific options if requested. the large penalty ensures
+    // that these will be satisfied if possible
+    for (int k = MUAAT_SUPERNOVA_PENALTY; k <= WINNU_PATH_PENALTY; k++) {
+        penalties[k] = 0;
+    }
+    if (evaluation_config.muaat_gets_supernova) {
+        if (not is_supernova_near_muaat(evaluation_config.muaat_gets_supernova, 
+                    distances)) {
+            penalties[MUAAT_SUPERNOVA_PENALTY] = 10;
+        }
+    }
+    if (evaluation_config.creuss_gets_wormhole) {
+        if (not is_wormhole_near_creuss(evaluation_config.creuss_gets_wormhole, 
+                    distances)) {
+            penalties[CREUSS_WORMHOLE_PENALTY] = 10;
+        }
+    }
+    if (evaluation_config.saar_get_asteroids) {
+        if (not is_asteroid_near_saar(evaluation_config.saar_get_asteroids, 
+                    distances)) {
+            penalties[SAAR_ASTEROIDS_PENALTY] = 10;
+        }
+    }
+    if (evaluation_config.winnu_have_clear_path_to_mecatol) {
+        if (not winnu_have_clear_path_to_mecatol( distances)) {
+            penalties[WINNU_PATH_PENALTY] = 10;
+        }
+    }
+    
+    float total_penalty = 0;
+    for (int k = 0; k < N_PENALTY_KINDS; k++) {
+        total_penalty += penalties[k];
+    }
+    return total_penalty;
+}
+
+float Galaxy::calculate_trait_variance(const TileMatrix& stakes, Scores& scores)
+{
+    scores.trait_counts.resize(home_systems.size());
+    for (int hs = 0; hs < (int) home_systems.size(); hs++)
+    {
+        int count = 0;
+        for (PlanetTrait trait : {CULTURAL, HAZARDOUS, INDUSTRIAL}) {
+            const vector<int>& trait_counts = tile_attributes.trait_counts[trait];
+            for (auto t : placed_tiles) {
+                int id = t->get_id();
+                if (tile_attributes.is_home_system[id]) {
+                    continue;
+                }
+                count += trait_counts[id] * stakes[hs][id];
+            }
+        }
+        scores.trait_counts[hs] = count;
+    }
+    return coefficient_of_variation(scores.trait_counts);
+}
+
+float Galaxy::calculate_ring_balance(const vector<float>& distances_from_mecatol) {
+    float resByRing[3] = {0, 0, 0};
+    float infByRing[3] = {0, 0, 0};
+    float techByRing[3] = {0, 0, 0};
+    int countByRing[3] = {0, 0, 0};
+
+    // add up res/inf/tech values by ring
+    for (auto tile : tiles_by_id) {
+        int id = tile->get_id();
+        float distance = distances_from_mecatol[id];
+        if (distance == UNREACHABLE or tile_attributes.is_home_system[id]) {
+            continue;
+        }
+        int ring;
+        if (distance <= 1.0) {
+            ring = 0;
+        } else if (distance <= 2.0) {
+            ring = 1;
+        } else {
+            ring = 2;
+        }
+        
+        resByRing[ring] += tile_attributes.resources[id];
+        infByRing[ring] += tile_attributes.influence[id];
+        techByRing[ring] += tile_attributes.has_tech[id];
+        countByRing[ring]++;
+    }
+
+    // calc average values per ring
+    for (int ring = 0; ring < 3; ring++) {
+        resByRing[ring] /= max(countByRing[ring], 1);
+        infByRing[ring] /= max(countByRing[ring], 1);
+        techByRing[ring] /= max(countByRing[ring], 1);
+    }
+
+    // skew toward mecatol based on ring_balance
+    resByRing[0] /= evaluation_config.ring_balance;
+    infByRing[0] /= evaluation_config.ring_balance;
+    techByRing[0] /= evaluation_config.ring_balance;
+
+    resByRing[2] *= evaluation_config.ring_balance;
+    infByRing[2] *= evaluation_config.ring_balance;
+    techByRing[2] *= evaluation_config.ring_balance;
+
+    float ringScore = 
+        coefficient_of_variation(resByRing, 3) * evaluation_config.resource_weight
+        + coefficient_of_variation(infByRing, 3) * evaluation_config.influence_weight
+        + coefficient_of_variation(techByRing, 3) * evaluation_config.tech_weight;
+    ringScore /= 3;
+
+    return ringScore;
+}
+
+float Galaxy::evaluate_grid() {
+    
+    // The matrices keep their size between evaluations so this only 
+    // allocates the first time
+    home_distances.resize(home_systems.size(), tiles_by_id.size());
+    for (int hs = 0; hs < (int) home_systems.size(); hs++) {
+        distance_to_other_tiles(home_systems[hs], home_distances[hs]);
+    }
+    mecatol_distances.resize(tiles_by_id.size());
+    distance_to_other_tiles(mecatol, mecatol_distances.data());
+
+    calculate_stakes(home_distances, stakes);
+
+    calculate_shares(stakes, scores);
+
+    grid_score = score_grid();
+    return grid_score;
+}
+
+/* Combines the cached distances, stakes and shares into the final score
+ */
+float Galaxy::score_grid() {
+
+    float score = 0;
+
+    score += first_turn_variance(stakes, scores) * evaluation_config.first_turn; 
+
+    if (evaluation_config.ring_balance) {
+        score += calculate_ring_balance(mecatol_distances) * evaluation_config.ring_balance_weight;
+    }
+
+    score += apply_penalties(home_distances);
+
+    score += calculate_trait_variance(stakes, scores) * evaluation_config.trait_weight;
+
+    score += coefficient_of_variation(scores.shares[RESOURCE_SHARE]) * evaluation_config.resource_weight
+           + coefficient_of_variation(scores.shares[INFLUENCE_SHARE]) * evaluation_config.influence_weight
+           + coefficient_of_variation(scores.shares[TECH_SHARE]) * evaluation_config.tech_weight;
+    score += coefficient_of_variation(scores.shares[RES_INF_SHARE]) * evaluation_config.res_inf_weight;; 
+
+    return score;
+}
+
+/* Returns true if swapping two tiles can change the distance between any pair
+ * of locations in the galaxy. Tiles that cost the same to move through and 
+ * have the same wormhole leave every path intact, so their distances and 
+ * stakes can simply be exchanged
+ */
+bool Galaxy::swap_changes_distances(Tile* a, Tile* b)
+{
+    return a->is_home_system() or b->is_home_system()
+        or a->get_wormhole() != b->get_wormhole()
+        or get_move_cost(a) != get_move_cost(b);
+}
+
+/* Adds (sign = 1) or removes (sign = -1) the contribution of a single tile to
+ * every home system's shares
+ */
+void Galaxy::add_tile_shares(Tile* t, float sign)
+{
+    int id = t->get_id();
+    const float* row = &tile_attributes.share_rows[id * SHARE_COLUMNS];
+    for (int hs = 0; hs < (int) home_systems.size(); hs++) {
+        float stake = sign * stakes[hs][id];
+        for (int k = 0; k < N_SHARE_KINDS; k++) {
+            scores.shares[k][hs] += row[k] * stake;
+        }
+    }
+}
+
+/* try_swap
+ * Swaps two tiles and returns the score of the new grid, only recomputing 
+ * what the swap can affect. Must be followed by accept_swap or reject_swap
+ */
+float Galaxy::try_swap(Tile* a, Tile* b)
+{
+    pending_move.tiles.assign({a, b});
+    pending_move.next.assign({1, 0});
+    return try_pending_move();
+}
+
+/* Makes a move from list like try_swap, to the tiles in its locations now
+ */
+float Galaxy::try_move(const MoveList& list, const Move& move)
+{
+    pending_move.tiles.clear();
+    pending_move.next.clear();
+    for (int i = move.first; i < move.first + move.size; i++) {
+        pending_move.tiles.push_back(get_tile_at(list.locations[i]));
+        pending_move.next.push_back(list.next[i]);
+    }
+    return try_pending_move();
+}
+
+/* Moves the tiles in pending_move and scores the new grid
+ */
+float Galaxy::try_pending_move()
+{
+    stats.swaps_tried++;
+    const vector<Tile*>& tiles = pending_move.tiles;
+    const vector<int>& next = pending_move.next;
+    int n = tiles.size();
+    pending_move.score = grid_score;
+    pending_move.full_evaluation = false;
+    pending_move.locations.clear();
+    for (int i = 0; i < n; i++) {
+        pending_move.locations.push_back(tiles[i]->get_location());
+        if (swap_changes_distances(tiles[0], tiles[i])) {
+            pending_move.full_evaluation = true;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        place_tile(pending_move.locations[next[i]], tiles[i]);
+    }
+
+    if (pending_move.full_evaluation) {
+        // Paths through the galaxy changed, start from scratch. The old
+        // results are moved out of the way rather than copied, and the 
+        // buffers from the last full evaluation are reused
+        swap(pending_move.home_distances, home_distances);
+        swap(pending_move.mecatol_distances, mecatol_distances);
+        swap(pending_move.stakes, stakes);
+        swap(pending_move.scores, scores);
+        return evaluate_grid();
+    }
+
+    // Every location is as far away as before, so each tile just takes over
+    // the distances of the tile whose place it took. Only their own stakes 
+    // need recalculating
+    pending_move.tile_distances.clear();
+    pending_move.tile_mecatol_distances.clear();
+    pending_move.tile_stakes.clear();
+    for (int hs = 0; hs < stakes.n_rows; hs++) {
+        for (auto t : tiles) {
+            pending_move.tile_distances.push_back(home_distances[hs][t->get_id()]);
+            pending_move.tile_stakes.push_back(stakes[hs][t->get_id()]);
+        }
+        for (int i = 0; i < n; i++) {
+            home_distances[hs][tiles[i]->get_id()] = 
+                pending_move.tile_distances[hs * n + next[i]];
+        }
+    }
+    for (auto t : tiles) {
+        pending_move.tile_mecatol_distances.push_back(mecatol_distances[t->get_id()]);
+    }
+    for (int i = 0; i < n; i++) {
+        mecatol_distances[tiles[i]->get_id()] = 
+            pending_move.tile_mecatol_distances[next[i]];
+    }
+
+    pending_move.scores = scores;
+    {
+        PhaseTimer timer(stats, SHARES_PHASE);
+        for (auto t : tiles) {
+            add_tile_shares(t, -1);
+        }
+    }
+    {
+        PhaseTimer timer(stats, STAKES_PHASE);
+        for (auto t : tiles) {
+            calculate_tile_stakes(t, home_distances, stakes);
+        }
+    }
+    {
+        PhaseTimer timer(stats, SHARES_PHASE);
+        for (auto t : tiles) {
+            add_tile_shares(t, 1);
+        }
+    }
+
+    grid_score = score_grid();
+    return grid_score;
+}
+
+void Galaxy::accept_swap()
+{
+    stats.swaps_accepted++;
+    if (not pending_move.full_evaluation) {
+        // Recalculate the shares from scratch so that rounding errors from
+        // the incremental updates cannot build up
+        calculate_shares(stakes, scores);
+    }
+}
+
+void Galaxy::reject_swap()
+{
+    const vector<Tile*>& tiles = pending_move.tiles;
+    int n = tiles.size();
+    for (int i = 0; i < n; i++) {
+        place_tile(pending_move.locations[i], tiles[i]);
+    }
+    grid_score = pending_move.score;
+
+    if (pending_move.full_evaluation) {
+        swap(pending_move.home_distances, home_distances);
+        swap(pending_move.mecatol_distances, mecatol_distances);
+        swap(pending_move.stakes, stakes);
+        swap(pending_move.scores, scores);
+        return;
+    }
+
+    for (int hs = 0; hs < stakes.n_rows; hs++) {
+        for (int i = 0; i < n; i++) {
+            home_distances[hs][tiles[i]->get_id()] = pending_move.tile_distances[hs * n + i];
+            stakes[hs][tiles[i]->get_id()] = pending_move.tile_stakes[hs * n + i];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        mecatol_distances[tiles[i]->get_id()] = pending_move.tile_mecatol_distances[i];
+    }
+    scores = pending_move.scores;
+}
+
+void Galaxy::swap_tiles(Tile* a, Tile* b)
+{
+    Location a_start = a->get_location();
+    Location b_start = b->get_location();
+
+    place_tile(a_start, b);
+    place_tile(b_start, a);
+}
+
+/* Move types from a comma separated list of their names, like 
+ * "swap,cycle"
+ */
+vector<MoveType> parse_move_types(string names)
+{
+    vector<MoveType> types;
+    stringstream names_ss(names);
+    string name;
+    while (getline(names_ss, name, ',')) {
+        if (not move_type_key.count(name)) {
+            throw invalid_argument("Unknown move type " + name);
+        }
+        if (find(types.begin(), types.end(), move_type_key[name]) == types.end()) {
+            types.push_back(move_type_key[name]);
+        }
+    }
+    if (types.empty()) {
+        throw invalid_argument("At least one move type is needed");
+    }
+    return types;
+}
+
+// Number of steps between two locations on the hex grid
+static int hex_distance(Location a, Location b)
+{
+    int di = b.i - a.i;
+    int dj = b.j - a.j;
+    if ((di >= 0) == (dj >= 0)) {
+        return MAX(abs(di), abs(dj));
+    }
+    return abs(di) + abs(dj);
+}
+
+// Direction from a to b, in radians
+static float hex_angle(Location a, Location b)
+{
+    float x = (b.j - a.j) - (b.i - a.i) / 2.0;
+    float y = (b.i - a.i) * sqrt(3) / 2;
+    return atan2(y, x);
+}
+
+/* Fills list with every move of the types in options.moves, type by type in
+ * that order. Swaps pair the movable systems in the order of 
+ * movable_systems and cycles take every three of them both ways round. Ring
+ * rotations turn the movable locations at each distance from mecatol rex
+ * round by one, both ways. Slice swaps exchange the movable locations 
+ * nearest to each pair of home systems, matched up by their distance and
+ * direction from their home system
+ */
+void Galaxy::make_move_list(const OptimizerOptions& options, MoveList& list)
+{
+    list.moves.clear();
+    list.locations.clear();
+    list.next.clear();
+    for (int type = 0; type < N_MOVE_TYPES; type++) {
+        list.type_begin[type] = 0;
+        list.type_end[type] = 0;
+    }
+    vector<Location> placement = get_placement();
+    int n = placement.size();
+    Location center = mecatol->get_location();
+
+    for (MoveType type : options.moves) {
+        list.type_begin[type] = list.moves.size();
+        switch (type) {
+            case SWAP_MOVE:
+                for (int a = 0; a < n; a++) {
+                    for (int b = a + 1; b < n; b++) {
+                        list.add(SWAP_MOVE, {placement[a], placement[b]}, {1, 0});
+                    }
+                }
+                break;
+            case CYCLE_MOVE:
+                for (int a = 0; a < n; a++) {
+                    for (int b = a + 1; b < n; b++) {
+                        for (int c = b + 1; c < n; c++) {
+                            list.add(CYCLE_MOVE, {placement[a], placement[b], 
+                                    placement[c]}, {1, 2, 0});
+                            list.add(CYCLE_MOVE, {placement[a], placement[b], 
+                                    placement[c]}, {2, 0, 1});
+                        }
+                    }
+                }
+                break;
+            case RING_ROTATION_MOVE: {
+                map<int, vector<Location>> rings;
+                for (auto l : placement) {
+                    rings[hex_distance(center, l)].push_back(l);
+                }
+                for (auto& ring : rings) {
+                    vector<Location>& locations = ring.second;
+                    int size = locations.size();
+                    if (size < 3) {
+                        continue;
+                    }
+                    stable_sort(locations.begin(), locations.end(), 
+                            [&](Location a, Location b) {
+                        return hex_angle(center, a) < hex_angle(center, b);
+                    });
+                    vector<int> forward;
+                    vector<int> backward;
+                    for (int i = 0; i < size; i++) {
+                        forward.push_back((i + 1) % size);
+                        backward.push_back((i + size - 1) % size);
+                    }
+                    list.add(RING_ROTATION_MOVE, locations, forward);
+                    list.add(RING_ROTATION_MOVE, locations, backward);
+                }
+                break;
+            }
+            case SLICE_SWAP_MOVE: {
+                // Locations go to the slice of the home system nearest to 
+                // them, unless two are just as near
+                int n_hs = home_systems.size();
+                vector<vector<Location>> slices(n_hs);
+                for (auto l : placement) {
+                    int nearest = -1;
+                    int nearest_distance = INT_MAX;
+                    for (int hs = 0; hs < n_hs; hs++) {
+                        int distance = hex_distance(home_systems[hs]->get_location(), l);
+                        if (distance < nearest_distance) {
+                            nearest = hs;
+                            nearest_distance = distance;
+                        } else if (distance == nearest_distance) {
+                            nearest = -1;
+                        }
+                    }
+                    if (nearest >= 0) {
+                        slices[nearest].push_back(l);
+                    }
+                }
+
+                // Nearest first, then from left to right looking towards 
+                // mecatol rex
+                for (int hs = 0; hs < n_hs; hs++) {
+                    Location home = home_systems[hs]->get_location();
+                    auto turn = [&](Location l) {
+                        return remainder(hex_angle(home, l) - hex_angle(home, center), 
+                                2 * M_PI);
+                    };
+                    stable_sort(slices[hs].begin(), slices[hs].end(), 
+                            [&](Location a, Location b) {
+                        int a_distance = hex_distance(home, a);
+                        int b_distance = hex_distance(home, b);
+                        if (a_distance != b_distance) {
+                            return a_distance < b_distance;
+                        }
+                        return turn(a) > turn(b);
+                    });
+                }
+
+                for (int a = 0; a < n_hs; a++) {
+                    for (int b = a + 1; b < n_hs; b++) {
+                        vector<Location> locations;
+                        vector<int> next;
+                        int size = MIN(slices[a].size(), slices[b].size());
+                        for (int i = 0; i < size; i++) {
+                            locations.push_back(slices[a][i]);
+                            locations.push_back(slices[b][i]);
+                            next.push_back(2 * i + 1);
+                            next.push_back(2 * i);
+                        }
+                        if (size) {
+                            list.add(SLICE_SWAP_MOVE, locations, next);
+                        }
+                    }
+                }
+                break;
+            }
+            case N_MOVE_TYPES:
+                break;
+        }
+        list.type_end[type] = list.moves.size();
+    }
+}
+
+/* Tries a random move for annealing and returns its score, or NAN without
+ * moving anything if it picked the same tile twice. With more than one move
+ * type the type is picked first, so the many cycles do not crowd out the few
+ * ring rotations and slice swaps. A type this galaxy has no moves of swaps
+ * instead
+ */
+float Galaxy::try_random_move(const OptimizerOptions& options, 
+        const MoveList& list, const vector<Tile*>& movable)
+{
+    MoveType type = options.moves[0];
+    if (options.moves.size() > 1) {
+        uniform_int_distribution<int> pick_type(0, options.moves.size() - 1);
+        type = options.moves[pick_type(rng)];
+    }
+    if (type != SWAP_MOVE and list.type_begin[type] < list.type_end[type]) {
+        uniform_int_distribution<int> pick_move(list.type_begin[type], 
+                list.type_end[type] - 1);
+        return try_move(list, list.moves[pick_move(rng)]);
+    }
+
+    uniform_int_distribution<int> pick_tile(0, movable.size() - 1);
+    Tile* a = movable[pick_tile(rng)];
+    Tile* b = movable[pick_tile(rng)];
+    if (a == b) {
+        return NAN;
+    }
+    return try_swap(a, b);
+}
+
+// Records the move just made in the trace by its first two tiles
+void Galaxy::trace_pending_move(const OptimizerOptions& options, 
+        const SearchBudget& budget, float current_score, float best_score)
+{
+    trace_move(options, budget, current_score, best_score, 
+            pending_move.tiles[0], pending_move.tiles[1]);
+}
+
+void Galaxy::print_pending_move(float new_score)
+{
+    if (pending_move.tiles.size() == 2) {
+        printf("Swapping tiles %d & %d, new_score: %0.3f\n", 
+                pending_move.tiles[0]->get_number(), 
+                pending_move.tiles[1]->get_number(), new_score);
+        return;
+    }
+    printf("Moving tiles");
+    for (auto t : pending_move.tiles) {
+        printf(" %d", t->get_number());
+    }
+    printf(", new_score: %0.3f\n", new_score);
+}
+
+/* Returns the locations of the movable systems, in the order of 
+ * movable_systems
+ */
+vector<Location> Galaxy::get_placement()
+{
+    vector<Location> placement;
+    for (auto t : movable_systems) {
+        placement.push_back(t->get_location());
+    }
+    return placement;
+}
+
+/* Moves the movable systems back to locations saved by get_placement
+ */
+void Galaxy::set_placement(const vector<Location>& placement)
+{
+    auto location = placement.begin();
+    for (auto t : movable_systems) {
+        place_tile(*location, t);
+        location++;
+    }
+}
+
+/* optimize_grid
+ * Swaps tiles to minimize the score of the current grid using the requested
+ * strategy, until it cannot improve or the budget runs out. Every strategy 
+ * finishes on the best grid it has seen, so a search cut off by the deadline
+ * still leaves a usable galaxy. The score is defined by evaluate_grid
+ */
+void Galaxy::optimize_grid(OptimizerOptions options)
+{
+    // The limit asked for, before the defaults that only set how long a 
+    // strategy runs
+    long max_evaluations = options.max_evaluations;
+    if ((options.strategy == ANNEAL or options.strategy == TABU)
+            and not options.max_evaluations and not options.time_limit_ms) {
+        options.max_evaluations = DEFAULT_ANNEAL_EVALUATIONS;
+    }
+    if (options.strategy == PARALLEL_TEMPERING
+            and not options.max_evaluations and not options.time_limit_ms) {
+        options.max_evaluations = DEFAULT_ANNEAL_EVALUATIONS 
+            * MAX(options.n_replicas, 2);
+    }
+    if (options.strategy == GENETIC
+            and not options.max_evaluations and not options.time_limit_ms) {
+        options.max_evaluations = DEFAULT_ANNEAL_EVALUATIONS 
+            * MAX(options.n_islands, 1);
+    }
+    SearchBudget budget(options.max_evaluations, options.time_limit_ms, 
+            options.deadline);
+    auto start = chrono::steady_clock::now();
+
+    switch (options.strategy) {
+        case HILL_CLIMB:
+            hill_climb(options, budget);
+            break;
+        case ANNEAL:
+            anneal(options, budget);
+            break;
+        case STEEPEST_DESCENT:
+            steepest_descent(options, budget);
+            break;
+        case TABU:
+            tabu_search(options, budget);
+            break;
+        case PARALLEL_TEMPERING:
+            parallel_tempering(options, budget);
+            break;
+        case GENETIC:
+            genetic(options, budget);
+            break;
+    }
+    if (options.exact) {
+        if (not max_evaluations and not options.time_limit_ms
+                and options.deadline == chrono::steady_clock::time_point::max()) {
+            max_evaluations = budget.n_evaluations + DEFAULT_EXACT_EVALUATIONS;
+        }
+        branch_and_bound(options, max_evaluations, budget);
+    }
+    trace_move(options, budget, grid_score, grid_score);
+    stop_reason = budget.stop_reason;
+    n_evaluations = budget.n_evaluations;
+    stats.evaluations += n_evaluations;
+    stats.optimize_ms += chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+}
+
+/* Records the grid the search has moved to in the trace, if there is one.
+ * a and b are the tiles just swapped, NULL for the grid it starts or stops on
+ */
+void Galaxy::trace_move(const OptimizerOptions& options, 
+        const SearchBudget& budget, float current_score, float best_score, 
+        Tile* a, Tile* b)
+{
+    if (options.trace) {
+        options.trace->record(restart, budget.n_evaluations, current_score,
+                best_score, a ? a->get_number() : 0, b ? b->get_number() : 0);
+    }
+}
+
+/* Makes the first move found that improves the score until no more moves 
+ * can be made
+ */
+void Galaxy::hill_climb(const OptimizerOptions& options, SearchBudget& budget)
+{
+    float current_score = evaluate_grid();
+    bool better_score_found = 0;
+    trace_move(options, budget, current_score, current_score);
+
+    int n_swaps = 0;
+    // Set to a very high value to test all swaps
+    int swaps_until_quit = 10000;
+
+    MoveList moves;
+    do {
+        better_score_found = false;
+        make_move_list(options, moves);
+        shuffle(moves.moves.begin(), moves.moves.end(), rng);
+
+        n_swaps = 0;
+        for (auto& move : moves.moves) {
+            float new_score = try_move(moves, move);
+            budget.n_evaluations++;
+            if (new_score < current_score) {
+                accept_swap();
+                better_score_found = true;
+                current_score = new_score;
+                trace_pending_move(options, budget, current_score, current_score);
+                if (options.verbose) {
+                    print_pending_move(current_score);
+                }
+                break;
+            } else {
+                reject_swap();
+            }
+            n_swaps++;
+            if (n_swaps > swaps_until_quit or budget.is_exhausted()) {
+                break;
+            }
+        }
+    } while (better_score_found and n_swaps < swaps_until_quit 
+            and not budget.is_exhausted());
+}
+
+/* Scores every possible move and makes the best one, until no move improves
+ * the score. The moves are split between n_threads workers, each scoring
+ * them on its own clone of the galaxy. All clones make the same moves, so 
+ * they always agree and the result does not depend on the number of threads.
+ * The workers are started once and wait for each scan in turn. The budget is
+ * checked on every move; a scan it cuts short chooses no move, and the grid
+ * stays as the last full scan left it
+ */
+void Galaxy::steepest_descent(const OptimizerOptions& options, SearchBudget& budget)
+{
+    float current_score = evaluate_grid();
+    trace_move(options, budget, current_score, current_score);
+
+    vector<unique_ptr<Galaxy>> clones;
+    vector<Galaxy*> workers = {this};
+    for (int i = 1; i < options.n_threads; i++) {
+        clones.push_back(unique_ptr<Galaxy>(clone()));
+        workers.push_back(clones.back().get());
+        // Each clone counts only its own work, added back in at the end
+        clones.back()->stats = GeneratorStats();
+        clones.back()->stats.timed = stats.timed;
+    }
+    int n_workers = workers.size();
+    long accepted_before = stats.swaps_accepted;
+
+    // Each worker reads the clock on its own budget. The evaluation limit is
+    // applied to the whole scan up front, so that where it cuts does not
+    // depend on the number of threads
+    vector<SearchBudget> worker_budgets(n_workers, budget.share(0, n_workers));
+    vector<long> n_scored(n_workers);
+    atomic<bool> out_of_time(false);
+
+    MoveList moves;
+    vector<float> swap_scores;
+    int n_to_score = 0;
+
+    // Moves are made of locations, so every clone can make them as they are
+    auto score_swaps = [&](int worker) {
+        Galaxy* galaxy = workers[worker];
+        SearchBudget& worker_budget = worker_budgets[worker];
+        n_scored[worker] = 0;
+        for (int i = worker; i < n_to_score; i += n_workers) {
+            if (out_of_time or worker_budget.is_exhausted()) {
+                out_of_time = true;
+                break;
+            }
+            swap_scores[i] = galaxy->try_move(moves, moves.moves[i]);
+            galaxy->reject_swap();
+            worker_budget.n_evaluations++;
+            n_scored[worker]++;
+        }
+    };
+
+    // The other workers wait for step to change, score their share of the
+    // moves and report back through n_busy
+    mutex step_mutex;
+    condition_variable step_started, step_finished;
+    long step = 0;
+    int n_busy = 0;
+    bool finished = false;
+    auto work = [&](int worker) {
+        long last_step = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(step_mutex);
+                step_started.wait(lock, [&] { 
+                    return finished or step != last_step; 
+                });
+                if (finished) {
+                    return;
+                }
+                last_step = step;
+            }
+            score_swaps(worker);
+            lock_guard<mutex> lock(step_mutex);
+            if (--n_busy == 0) {
+                step_finished.notify_one();
+            }
+        }
+    };
+    vector<thread> threads;
+    for (int worker = 1; worker < n_workers; worker++) {
+        threads.push_back(thread(work, worker));
+    }
+
+    while (not budget.is_exhausted()) {
+        make_move_list(options, moves);
+        shuffle(moves.moves.begin(), moves.moves.end(), rng);
+        swap_scores.assign(moves.moves.size(), INFINITY);
+        n_to_score = moves.moves.size();
+        if (options.max_evaluations) {
+            n_to_score = MIN(n_to_score, 
+                    options.max_evaluations - budget.n_evaluations);
+        }
+
+        {
+            lock_guard<mutex> lock(step_mutex);
+            step++;
+            n_busy = n_workers - 1;
+        }
+        step_started.notify_all();
+        score_swaps(0);
+        {
+            unique_lock<mutex> lock(step_mutex);
+            step_finished.wait(lock, [&] { return n_busy == 0; });
+        }
+
+        for (int worker = 0; worker < n_workers; worker++) {
+            budget.n_evaluations += n_scored[worker];
+        }
+        if (out_of_time) {
+            for (auto& worker_budget : worker_budgets) {
+                if (worker_budget.stop_reason != CONVERGED) {
+                    budget.stop_reason = worker_budget.stop_reason;
+                }
+            }
+            break;
+        }
+        if (n_to_score < (int) moves.moves.size()) {
+            budget.is_exhausted();
+            break;
+        }
+
+        int best = min_element(swap_scores.begin(), swap_scores.end()) 
+            - swap_scores.begin();
+        if (moves.moves.empty() or swap_scores[best] >= current_score) {
+            break;
+        }
+
+        for (auto galaxy : workers) {
+            galaxy->try_move(moves, moves.moves[best]);
+            galaxy->accept_swap();
+        }
+        current_score = swap_scores[best];
+        trace_pending_move(options, budget, current_score, current_score);
+        if (options.verbose) {
+            print_pending_move(current_score);
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(step_mutex);
+        finished = true;
+    }
+    step_started.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // The clones repeat every swap this galaxy makes, so only the swaps they
+    // scored count towards the total
+    long n_moves = stats.swaps_accepted - accepted_before;
+    for (auto& copy : clones) {
+        copy->stats.swaps_tried -= n_moves;
+        copy->stats.swaps_accepted = 0;
+        stats.add(copy->stats);
+    }
+}
+
+/* Tabu search. Scores every move and makes the best one even when it makes
+ * the score worse, so that the search walks out of local minima instead of 
+ * stopping in them. Swapping a pair of tiles makes swapping them back tabu 
+ * for the next tabu_tenure moves, which stops it from falling straight back
+ * into the minimum it just left. A tabu move is still made if it gives the 
+ * best grid seen so far. Runs until the budget is used up and finishes on 
+ * the best grid seen
+ */
+void Galaxy::tabu_search(const OptimizerOptions& options, SearchBudget& budget)
+{
+    float current_score = evaluate_grid();
+    float best_score = current_score;
+    vector<Location> best_placement = get_placement();
+    trace_move(options, budget, current_score, best_score);
+
+    // The move from which each pair of tiles may be swapped again, indexed by
+    // the ids of both tiles, lowest first
+    int n_ids = tiles_by_id.size();
+    vector<long> tabu_until(n_ids * n_ids, 0);
+
+    // Each tile of a move takes the place of another. A move is tabu if any
+    // of these pairs is
+    auto pair_index = [&](int i) {
+        int a = pending_move.tiles[i]->get_id();
+        int b = pending_move.tiles[pending_move.next[i]]->get_id();
+        return MIN(a, b) * n_ids + MAX(a, b);
+    };
+
+    MoveList moves;
+    for (long move = 1; not budget.is_exhausted(); move++) {
+        make_move_list(options, moves);
+        shuffle(moves.moves.begin(), moves.moves.end(), rng);
+        int chosen = -1;
+        float chosen_score = INFINITY;
+        for (int i = 0; i < (int) moves.moves.size() and not budget.is_exhausted(); i++) {
+            float new_score = try_move(moves, moves.moves[i]);
+            reject_swap();
+            budget.n_evaluations++;
+
+            bool tabu = false;
+            for (int t = 0; t < (int) pending_move.tiles.size(); t++) {
+                tabu = tabu or tabu_until[pair_index(t)] > move;
+            }
+            // Swapping two tiles that are alike leaves the score as it was.
+            // Such a swap is never worse than the real moves, so it would be
+            // made over and over without going anywhere
+            if (new_score == current_score) {
+                continue;
+            }
+            if ((not tabu or new_score < best_score) and new_score < chosen_score) {
+                chosen = i;
+                chosen_score = new_score;
+            }
+        }
+        // A move chosen from only part of the moves is not worth making
+        if (chosen < 0 or budget.is_exhausted()) {
+            break;
+        }
+
+        try_move(moves, moves.moves[chosen]);
+        accept_swap();
+        for (int t = 0; t < (int) pending_move.tiles.size(); t++) {
+            tabu_until[pair_index(t)] = move + options.tabu_tenure + 1;
+        }
+        current_score = chosen_score;
+        if (current_score < best_score) {
+            best_score = current_score;
+            best_placement = get_placement();
+        }
+        trace_pending_move(options, budget, current_score, best_score);
+    }
+
+    if (options.verbose) {
+        printf("Tabu search ran for %ld evaluations, best score: %0.3f\n", 
+                budget.n_evaluations, best_score);
+    }
+    set_placement(best_placement);
+    evaluate_grid();
+}
+
+/* Keeps the move just tried if it made the grid better, or worse by little
+ * enough to pass the Metropolis test at temperature: with probability 
+ * exp(-score increase / temperature). Returns whether the move was kept
+ */
+bool Galaxy::anneal_step(float temperature)
+{
+    float increase = grid_score - pending_move.score;
+    uniform_real_distribution<float> uniform(0, 1);
+    if (increase <= 0 or uniform(rng) < exp(-increase / temperature)) {
+        accept_swap();
+        return true;
+    }
+    reject_swap();
+    return false;
+}
+
+/* Makes n_evaluations annealing steps at a fixed temperature, keeping the 
+ * best grid seen in best_score and best_placement. Stops early when budget
+ * runs out, and returns the number of steps made
+ */
+long Galaxy::anneal_chain(const OptimizerOptions& options, const MoveList& moves,
+        float temperature, long n_evaluations, SearchBudget& budget, 
+        float& best_score, vector<Location>& best_placement)
+{
+    vector<Tile*> movable(movable_systems.begin(), movable_systems.end());
+    long evaluation = 0;
+    while (evaluation < n_evaluations and not budget.is_exhausted()) {
+        if (isnan(try_random_move(options, moves, movable))) {
+            continue;
+        }
+        evaluation++;
+        budget.n_evaluations++;
+        if (anneal_step(temperature) and grid_score < best_score) {
+            best_score = grid_score;
+            best_placement = get_placement();
+        }
+    }
+    return evaluation;
+}
+
+/* Parallel tempering. Runs n_replicas annealing chains on copies of the 
+ * galaxy, each at a fixed temperature spaced geometrically from 
+ * end_temperature up to start_temperature. Hot chains roam the whole 
+ * landscape while cold ones settle into the minima they are handed. After 
+ * every exchange_interval steps neighbouring chains trade temperatures with
+ * the replica exchange probability, so good grids found by hot chains sink
+ * towards the coldest one. The chains are split between n_threads workers.
+ * Each chain has its own random stream and the exchanges are decided here,
+ * so the result does not depend on the number of threads. Finishes on the 
+ * best grid any chain has seen. The ladder needs both temperatures to be
+ * positive, which generate_galaxy checks
+ */
+void Galaxy::parallel_tempering(const OptimizerOptions& options, 
+        SearchBudget& budget)
+{
+    float best_score = evaluate_grid();
+    vector<Location> best_placement = get_placement();
+    trace_move(options, budget, best_score, best_score);
+    int n_replicas = MAX(options.n_replicas, 2);
+    if (movable_systems.size() < 2) {
+        return;
+    }
+
+    vector<unique_ptr<Galaxy>> replicas;
+    vector<float> temperatures;
+    vector<float> best_scores(n_replicas, best_score);
+    vector<vector<Location>> best_placements(n_replicas, best_placement);
+    for (int r = 0; r < n_replicas; r++) {
+        replicas.push_back(unique_ptr<Galaxy>(clone()));
+        replicas.back()->rng.seed(rng());
+        // Each replica counts only its own work, added back in at the end
+        replicas.back()->stats = GeneratorStats();
+        replicas.back()->stats.timed = stats.timed;
+        temperatures.push_back(options.end_temperature 
+                * pow(options.start_temperature / options.end_temperature, 
+                    (float) r / (n_replicas - 1)));
+    }
+    // The replica at each temperature, coldest first
+    vector<int> replica_at(n_replicas);
+    for (int r = 0; r < n_replicas; r++) {
+        replica_at[r] = r;
+    }
+    int n_workers = MIN(MAX(options.n_threads, 1), n_replicas);
+    uniform_real_distribution<float> uniform(0, 1);
+    MoveList moves;
+    make_move_list(options, moves);
+    // Each chain reads the clock on its own budget, so that a time limit or
+    // deadline stops it partway through a round
+    vector<SearchBudget> replica_budgets(n_replicas, budget.share(0, n_replicas));
+    vector<long> n_steps_made(n_replicas);
+
+    for (int round = 0; not budget.is_exhausted(); round++) {
+        long n_steps = options.exchange_interval;
+        if (options.max_evaluations) {
+            n_steps = MIN(n_steps, (options.max_evaluations 
+                        - budget.n_evaluations + n_replicas - 1) / n_replicas);
+        }
+
+        auto run_chains = [&](int worker) {
+            for (int t = worker; t < n_replicas; t += n_workers) {
+                int r = replica_at[t];
+                n_steps_made[r] = replicas[r]->anneal_chain(options, moves, 
+                        temperatures[t], n_steps, replica_budgets[r], 
+                        best_scores[r], best_placements[r]);
+            }
+        };
+        vector<thread> threads;
+        for (int worker = 1; worker < n_workers; worker++) {
+            threads.push_back(thread(run_chains, worker));
+        }
+        run_chains(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+        for (int r = 0; r < n_replicas; r++) {
+            budget.n_evaluations += n_steps_made[r];
+            if (replica_budgets[r].stop_reason != CONVERGED) {
+                budget.stop_reason = replica_budgets[r].stop_reason;
+            }
+        }
+
+        // Even rounds pair up temperatures 0 & 1, 2 & 3..., odd rounds 1 & 2...
+        for (int t = round % 2; t + 1 < n_replicas; t += 2) {
+            float colder = replicas[replica_at[t]]->grid_score;
+            float hotter = replicas[replica_at[t + 1]]->grid_score;
+            float log_p = (colder - hotter) 
+                * (1 / temperatures[t] - 1 / temperatures[t + 1]);
+            if (log_p >= 0 or uniform(rng) < exp(log_p)) {
+                swap(replica_at[t], replica_at[t + 1]);
+            }
+        }
+
+        int best = min_element(best_scores.begin(), best_scores.end()) 
+            - best_scores.begin();
+        best_score = best_scores[best];
+        trace_move(options, budget, replicas[replica_at[0]]->grid_score, 
+                best_score);
+    }
+
+    int best = min_element(best_scores.begin(), best_scores.end()) 
+        - best_scores.begin();
+    for (auto& replica : replicas) {
+        stats.add(replica->stats);
+    }
+    if (options.verbose) {
+        printf("Tempered %d replicas for %ld evaluations, best score: %0.3f\n", 
+                n_replicas, budget.n_evaluations, best_scores[best]);
+    }
+    set_placement(best_placements[best]);
+    evaluate_grid();
+}
+
+/* A placement of the movable systems, as the index in the starting placement
+ * of the location each one is in, and its score
+ */
+typedef struct Genome
+{
+    vector<int> genes;
+    float score;
+} Genome;
+
+/* One population of the genetic optimizer, evolved on its own copy of the
+ * galaxy with its own share of the optimizer's budget
+ */
+struct Galaxy::Island
+{
+    unique_ptr<Galaxy> galaxy;
+    SearchBudget budget;
+    vector<Genome> population;
+    Genome best;
+    long generation = 0;
+
+    Island(const SearchBudget& budget) : budget(budget) {};
+};
+
+/* Order crossover. The child takes the genes between two random cut points
+ * from first, and the genes it is still missing in the order they follow the
+ * second cut point in second. Every gene appears once in the child, so it 
+ * places each movable system in a different location
+ */
+static vector<int> order_crossover(const vector<int>& first, 
+        const vector<int>& second, mt19937& rng)
+{
+    int n = first.size();
+    uniform_int_distribution<int> pick_gene(0, n - 1);
+    int start = pick_gene(rng);
+    int end = pick_gene(rng);
+    if (start > end) {
+        swap(start, end);
+    }
+
+    vector<int> child(n);
+    vector<bool> taken(n, false);
+    for (int i = start; i <= end; i++) {
+        child[i] = first[i];
+        taken[first[i]] = true;
+    }
+    int next = (end + 1) % n;
+    for (int i = 1; i <= n; i++) {
+        int gene = second[(end + i) % n];
+        if (not taken[gene]) {
+            child[next] = gene;
+            next = (next + 1) % n;
+        }
+    }
+    return child;
+}
+
+// Puts genome in place of the worst member of population, if it is better
+static void replace_worst(vector<Genome>& population, const Genome& genome)
+{
+    auto worst = max_element(population.begin(), population.end(), 
+            [](const Genome& a, const Genome& b) {return a.score < b.score;});
+    if (genome.score >= worst->score) {
+        return;
+    }
+    // A copy of a member would soon take over the whole population
+    for (auto& member : population) {
+        if (member.score == genome.score) {
+            return;
+        }
+    }
+    *worst = genome;
+}
+
+/* Offers the best genome of the island to the next island through outbox, 
+ * and takes the one the previous island offered through inbox, if there is
+ * one. A slot holds at most one genome and is only touched by atomic 
+ * exchanges, so islands never wait for each other. An offer that is not 
+ * taken before the next one is dropped
+ */
+static void migrate(vector<Genome>& population, const Genome& best, 
+        atomic<Genome*>& outbox, atomic<Genome*>& inbox)
+{
+    delete outbox.exchange(new Genome(best));
+    Genome* migrant = inbox.exchange(NULL);
+    if (migrant) {
+        replace_worst(population, *migrant);
+        delete migrant;
+    }
+}
+
+// Places the movable systems in the locations genes picks out of placement
+float Galaxy::place_genes(const vector<Location>& placement, 
+        const vector<int>& genes)
+{
+    auto gene = genes.begin();
+    for (auto t : movable_systems) {
+        place_tile(placement[*gene], t);
+        gene++;
+    }
+    return evaluate_grid();
+}
+
+/* Breeds one generation of children on the island. Parents are picked by 
+ * tournaments of three and crossed with order_crossover. Each child then 
+ * gets mutation_swaps random swaps, each kept unless it makes the child 
+ * worse, and replaces the worst member of the population if it is better.
+ * Must be called on the island's galaxy
+ */
+void Galaxy::breed(Island& island, const OptimizerOptions& options, 
+        const vector<Location>& placement)
+{
+    vector<Tile*> movable(movable_systems.begin(), movable_systems.end());
+    vector<Genome>& population = island.population;
+    uniform_int_distribution<int> pick_member(0, population.size() - 1);
+    uniform_int_distribution<int> pick_gene(0, movable.size() - 1);
+    auto tournament = [&]() -> const Genome& {
+        const Genome* winner = &population[pick_member(rng)];
+        for (int i = 1; i < 3; i++) {
+            const Genome* rival = &population[pick_member(rng)];
+            if (rival->score < winner->score) {
+                winner = rival;
+            }
+        }
+        return *winner;
+    };
+
+    for (int i = 0; i < (int) population.size() 
+            and not island.budget.is_exhausted(); i++) {
+        Genome child;
+        const Genome& first = tournament();
+        const Genome& second = tournament();
+        child.genes = order_crossover(first.genes, second.genes, rng);
+        child.score = place_genes(placement, child.genes);
+        island.budget.n_evaluations++;
+
+        for (int m = 0; m < options.mutation_swaps; m++) {
+            int a = pick_gene(rng);
+            int b = pick_gene(rng);
+            if (a == b) {
+                continue;
+            }
+            float new_score = try_swap(movable[a], movable[b]);
+            island.budget.n_evaluations++;
+            if (new_score <= child.score) {
+                accept_swap();
+                swap(child.genes[a], child.genes[b]);
+                child.score = new_score;
+            } else {
+                reject_swap();
+            }
+        }
+
+        replace_worst(population, child);
+        if (child.score < island.best.score) {
+            island.best = child;
+            trace_move(options, island.budget, child.score, child.score);
+        }
+    }
+    island.generation++;
+}
+
+/* Island model genetic algorithm. Each of n_islands evolves its own 
+ * population of placements with breed. Every migration_interval generations
+ * each island sends its best placement to the next one, in a ring. The 
+ * islands are split between n_threads workers and run without waiting for 
+ * each other, so with more than one thread the result depends on when the 
+ * migrants arrive. Each island gets an even share of budget, which keeps its
+ * start, time limit and deadline. Finishes on the best placement any island
+ * has found
+ */
+void Galaxy::genetic(const OptimizerOptions& options, SearchBudget& budget)
+{
+    float start_score = evaluate_grid();
+    trace_move(options, budget, start_score, start_score);
+    int n_genes = movable_systems.size();
+    if (n_genes < 2) {
+        return;
+    }
+    vector<Location> placement = get_placement();
+    int n_islands = MAX(options.n_islands, 1);
+    int population_size = MAX(options.population, 2);
+    int migration_interval = MAX(options.migration_interval, 1);
+
+    vector<unique_ptr<Island>> islands;
+    for (int i = 0; i < n_islands; i++) {
+        islands.push_back(unique_ptr<Island>(new Island(
+                        budget.share(options.max_evaluations, n_islands))));
+        Island& island = *islands.back();
+        island.galaxy.reset(clone());
+        island.galaxy->rng.seed(rng());
+        // Each island counts only its own work, added back in at the end
+        island.galaxy->stats = GeneratorStats();
+        island.galaxy->stats.timed = stats.timed;
+
+        // The starting grid is kept on the first island, so the result is
+        // never worse than it
+        for (int m = 0; m < population_size; m++) {
+            Genome genome;
+            for (int g = 0; g < n_genes; g++) {
+                genome.genes.push_back(g);
+            }
+            if (i or m) {
+                shuffle(genome.genes.begin(), genome.genes.end(), 
+                        island.galaxy->rng);
+            }
+            genome.score = island.galaxy->place_genes(placement, genome.genes);
+            island.budget.n_evaluations++;
+            island.population.push_back(genome);
+        }
+        island.best = *min_element(island.population.begin(), 
+                island.population.end(), 
+                [](const Genome& a, const Genome& b) {return a.score < b.score;});
+    }
+
+    // Slot i holds the genome island i offers to island i + 1
+    unique_ptr<atomic<Genome*>[]> slots(new atomic<Genome*>[n_islands]);
+    for (int i = 0; i < n_islands; i++) {
+        slots[i].store(NULL);
+    }
+
+    int n_workers = MIN(MAX(options.n_threads, 1), n_islands);
+    auto evolve = [&](int worker) {
+        bool running = true;
+        while (running) {
+            running = false;
+            for (int i = worker; i < n_islands; i += n_workers) {
+                Island& island = *islands[i];
+                if (island.budget.is_exhausted()) {
+                    continue;
+                }
+                running = true;
+                island.galaxy->breed(island, options, placement);
+                if (island.generation % migration_interval == 0) {
+                    migrate(island.population, island.best, slots[i], 
+                            slots[(i + n_islands - 1) % n_islands]);
+                }
+            }
+        }
+    };
+    vector<thread> threads;
+    for (int worker = 1; worker < n_workers; worker++) {
+        threads.push_back(thread(evolve, worker));
+    }
+    evolve(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    Genome* best = &islands[0]->best;
+    for (auto& island : islands) {
+        budget.n_evaluations += island->budget.n_evaluations;
+        if (budget.stop_reason == CONVERGED) {
+            budget.stop_reason = island->budget.stop_reason;
+        }
+        if (island->best.score < best->score) {
+            best = &island->best;
+        }
+        stats.add(island->galaxy->stats);
+    }
+    for (int i = 0; i < n_islands; i++) {
+        delete slots[i].exchange(NULL);
+    }
+
+    if (options.verbose) {
+        printf("Evolved %d islands for %ld evaluations, best score: %0.3f\n", 
+                n_islands, budget.n_evaluations, best->score);
+    }
+    place_genes(placement, best->genes);
+}
+
+/* Simulated annealing. Tries random swaps of movable systems, always keeping
+ * better grids and keeping worse grids with probability 
+ * exp(-score increase / temperature), so that it can climb out of local 
+ * minima that no single swap escapes. The temperature falls from 
+ * start_temperature to end_temperature as the budget is used up. Finishes on
+ * the best grid seen
+ */
+void Galaxy::anneal(const OptimizerOptions& options, SearchBudget& budget)
+{
+    vector<Tile*> movable(movable_systems.begin(), movable_systems.end());
+    float current_score = evaluate_grid();
+    if (movable.size() < 2) {
+        return;
+    }
+
+    MoveList moves;
+    make_move_list(options, moves);
+
+    float best_score = current_score;
+    vector<Location> best_placement = get_placement();
+    trace_move(options, budget, current_score, best_score);
+
+    while (not budget.is_exhausted()) {
+        float fraction = budget.fraction_used();
+        float temperature;
+        if (options.schedule == LINEAR) {
+            temperature = options.start_temperature 
+                + (options.end_temperature - options.start_temperature) * fraction;
+        } else {
+            temperature = options.start_temperature 
+                * pow(options.end_temperature / options.start_temperature, fraction);
+        }
+
+        if (isnan(try_random_move(options, moves, movable))) {
+            continue;
+        }
+
+        budget.n_evaluations++;
+        if (anneal_step(temperature)) {
+            current_score = grid_score;
+            if (current_score < best_score) {
+                best_score = current_score;
+                best_placement = get_placement();
+            }
+            trace_pending_move(options, budget, current_score, best_score);
+        }
+    }
+
+    if (options.verbose) {
+        printf("Annealed for %ld evaluations, best score: %0.3f\n", 
+                budget.n_evaluations, best_score);
+    }
+    set_placement(best_placement);
+    evaluate_grid();
+}
+
+json Galaxy::to_json()
+{
+    json j;
+
+    // Record tile hex grid layout
+    j["grid"] = json::array();
+    for (int i = 0; i < grid_rows; i++) {
+        auto row = json::array();
+        for (int j = 0; j < grid_columns; j++) {
+            row.push_back(grid[get_cell_index({i, j})]->get_number());
+        }
+        j["grid"].push_back(row);
+    }
+
+    // Record any warp connectiongs
+    for (auto wc : warp_connections) {
+        j["warp_connections"].push_back({{wc[0].i, wc[0].j}, {wc[1].i, wc[1].j}}); }
+
+    // Record the overal scores and stakes in each system
+    for (int hs = 0; hs < (int) home_systems.size(); hs++) {
+        string race = home_systems[hs]->get_race();
+        j["scores"][race]["resource"] = scores.shares[RESOURCE_SHARE][hs];
+        j["scores"][race]["influence"] = scores.shares[INFLUENCE_SHARE][hs];
+        j["scores"][race]["tech"] = scores.shares[TECH_SHARE][hs];
+        j["scores"][race]["res_inf"] = scores.shares[RES_INF_SHARE][hs];
+        j["scores"][race]["first_turn"] = scores.first_turn_share[hs];
+
+    }
+
+    // Only record the systems somebody has a stake in
+    for (auto t : placed_tiles) {
+        float total_stake = 0;
+        for (int hs = 0; hs < stakes.n_rows; hs++) {
+            total_stake += stakes[hs][t->get_id()];
+        }
+        if (not total_stake) {
+            continue;
+        }
+        for (int hs = 0; hs < stakes.n_rows; hs++) {
+            float stake = stakes[hs][t->get_id()];
+            j["stakes"][to_string(t->get_number())][home_systems[hs]->get_race()] = stake;
+        }
+    }
+
+    j["mecatol"] = {mecatol->get_location().i, mecatol->get_location().j};
+
+    // The adjacency penalties are always listed, the race ones only if given
+    for (int k = 0; k < N_PENALTY_KINDS; k++) {
+        if (k <= ADJACENT_WORMHOLES_PENALTY or scores.penalties[k]) {
+            j["penalties"][penalty_names[k]] = scores.penalties[k];
+        }
+    }
+
+    // Whether the optimization finished or was cut short
+    j["search"]["stopped_by"] = stop_reason_names[stop_reason];
+    j["search"]["converged"] = stop_reason == CONVERGED;
+    j["search"]["evaluations"] = n_evaluations;
+    if (exact_result.searched) {
+        j["search"]["exact"]["proven"] = exact_result.proven;
+        j["search"]["exact"]["lower_bound"] = exact_result.lower_bound;
+        j["search"]["exact"]["gap"] = grid_score - exact_result.lower_bound;
+        j["search"]["exact"]["unavoidable_penalty"] = exact_result.unavoidable_penalty;
+
+        // The gap as a fraction of what placement can still change
+        float avoidable = grid_score - exact_result.unavoidable_penalty;
+        j["search"]["exact"]["relative_gap"] = avoidable > 0 
+            ? (grid_score - exact_result.lower_bound) / avoidable : 0;
+        j["search"]["exact"]["nodes"] = exact_result.nodes;
+    }
+    return j;
+}
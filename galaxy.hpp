@@ -0,0 +1,820 @@
+#ifndef TI4_GALAXY_HPP
+#define TI4_GALAXY_HPP
+
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <set>
+#include <map>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <time.h>
+#include <exception>
+#include <stdexcept>
+#include <cmath>
+#include <iterator>
+#include <sstream>
+#include <climits>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <chrono>
+
+#include "json.hpp"
+#include "share_kernels.hpp"
+#include "convergence_trace.hpp"
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+using json = nlohmann::json;
+using namespace std;
+
+enum PlanetTrait
+{
+    NO_TRAIT,
+    CULTURAL,
+    INDUSTRIAL,
+    HAZARDOUS
+};
+
+static map<string, PlanetTrait> trait_key = {
+    {"NO_TRAIT", NO_TRAIT},
+    {"CULTURAL", CULTURAL},
+    {"HAZARDOUS", HAZARDOUS},
+    {"INDUSTRIAL", INDUSTRIAL}
+};
+
+enum TechColor
+{
+    NO_TECH,
+    BLUE,
+    RED,
+    GREEN,
+    YELLOW
+};
+
+static map<string, TechColor> tech_key = {
+    {"NO_TECH", NO_TECH},
+    {"BLUE", BLUE},
+    {"RED", RED},
+    {"GREEN", GREEN},
+    {"YELLOW", YELLOW}
+};
+
+enum Wormhole
+{
+    NO_WORMHOLE,
+    ALPHA,
+    BETA,
+    DELTA
+};
+
+static map<string, Wormhole> wormhole_key = {
+    {"NO_WORMHOLE", NO_WORMHOLE},
+    {"ALPHA", ALPHA},
+    {"BETA", BETA},
+    {"DELTA", DELTA}
+};
+
+enum Anomaly
+{
+    NO_ANOMALY,
+    EMPTY,
+    GRAVITY_RIFT,
+    NEBULA,
+    SUPERNOVA,
+    ASTEROID_FIELD
+};
+
+static map<string, Anomaly> anomaly_key = {
+    {"NO_ANOMALY", NO_ANOMALY},
+    {"EMPTY", EMPTY},
+    {"GRAVITY_RIFT", GRAVITY_RIFT},
+    {"NEBULA", NEBULA},
+    {"SUPERNOVA", SUPERNOVA},
+    {"ASTEROID_FIELD", ASTEROID_FIELD},
+};
+
+typedef struct Planet
+{
+    string name;
+    int resources;
+    int influence;
+    PlanetTrait trait;
+    TechColor tech;
+} Planet;
+
+typedef struct Location
+{
+    int i;
+    int j;
+
+    Location operator+(Location a) {
+        struct Location new_location;
+        new_location.i = this->i + a.i;
+        new_location.j = this->j + a.j;
+        return new_location;
+    }
+    bool operator==(Location a) {
+        return i == a.i && j == a.j;
+    }
+} Location;
+
+
+
+class Tile
+{
+    int number;
+    Wormhole wormhole;
+    list<Planet> planets;
+    Anomaly anomaly;
+    Location location;
+    string race;
+    int id = -1; // Dense index into the galaxy's tile matrices
+
+    int resources = 0;
+    int influence = 0;
+    float res_inf = 0;
+
+    public:
+    Tile(int);
+    Tile(int, string);
+    Tile(int, list<Planet>, Wormhole, Anomaly);
+    Tile(int, list<Planet>, string race);
+    string get_description_string() const;
+    int get_number();
+    int get_id();
+    void set_id(int);
+    Wormhole get_wormhole();
+    Anomaly get_anomaly();
+    TechColor get_techcolor();
+    void set_location(Location);
+    Location get_location();
+    int get_resource_value();
+    int get_influence_value();
+    float get_res_inf_value();
+    const list<Planet>& get_planets();
+    string get_race();
+    bool is_home_system();
+};
+
+std::ostream& operator<< (std::ostream &out, Tile const& tile);
+
+// Move costs are counted in tenths of a move so that path lengths are exact
+// integers
+#define MOVE_COST_SCALE 10
+#define MAX_MOVE_COST 20
+
+int get_move_cost(Tile* tile);
+
+/* Index of the lowest set bit of a non-zero mask
+ */
+inline int lowest_bit(uint64_t mask)
+{
+    return __builtin_ctzll(mask);
+}
+
+inline int lowest_bit(__uint128_t mask)
+{
+    uint64_t low = (uint64_t) mask;
+    if (low) {
+        return __builtin_ctzll(low);
+    }
+    return 64 + __builtin_ctzll((uint64_t) (mask >> 64));
+}
+
+/* Sets of locations in the galaxy stored as bit masks, with one bit for each
+ * valid location ("slot") of the layout. Only usable if the layout has no 
+ * more locations than there are bits in Mask
+ */
+template <class Mask>
+struct Bitboard
+{
+    vector<Mask> neighbours;    // Hex neighbours and warp lanes of each slot
+    vector<Tile*> tiles;        // Tile currently placed in each slot
+    Mask move_cost[MAX_MOVE_COST + 1]; // Slots by the cost of leaving them
+    Mask home_systems;          // Slots that block movement
+    Mask wormholes[DELTA + 1];  // Slots by wormhole type
+
+    void resize(int n_slots) {
+        neighbours.assign(n_slots, 0);
+        tiles.assign(n_slots, NULL);
+        fill(move_cost, move_cost + MAX_MOVE_COST + 1, 0);
+        home_systems = 0;
+        fill(wormholes, wormholes + DELTA + 1, 0);
+    }
+
+    // Updates every mask for the tile now placed in slot
+    void place(int slot, Tile* tile) {
+        Mask bit = (Mask) 1 << slot;
+        for (auto& mask : move_cost) {
+            mask &= ~bit;
+        }
+        home_systems &= ~bit;
+        for (auto& mask : wormholes) {
+            mask &= ~bit;
+        }
+
+        tiles[slot] = tile;
+        if (not tile) {
+            return;
+        }
+        if (get_move_cost(tile) >= 0) {
+            move_cost[get_move_cost(tile)] |= bit;
+        }
+        if (tile->is_home_system()) {
+            home_systems |= bit;
+        }
+        wormholes[tile->get_wormhole()] |= bit;
+    }
+};
+
+/* Row major matrix of values indexed by [home system][tile id], kept as one
+ * contiguous block so that it can be reused between evaluations
+ */
+typedef struct TileMatrix
+{
+    int n_rows = 0;
+    int n_cols = 0;
+    vector<float> values;
+
+    void resize(int rows, int cols) {
+        n_rows = rows;
+        n_cols = cols;
+        values.resize(rows * cols);
+    }
+    float* operator[](int row) {
+        return &values[row * n_cols];
+    }
+    const float* operator[](int row) const {
+        return &values[row * n_cols];
+    }
+    // Exchanges the values of two tiles in every row
+    void swap_columns(int a, int b) {
+        for (int row = 0; row < n_rows; row++) {
+            swap(values[row * n_cols + a], values[row * n_cols + b]);
+        }
+    }
+} TileMatrix;
+
+// Distance recorded for tiles that cannot be reached at all
+#define UNREACHABLE INFINITY
+
+enum HomeSystemSetups {DUMMY, RANDOM_RACES, CHOSEN_RACES};
+
+struct layout_info
+{
+    int n_blue;
+    int n_red;
+    list<Location> start_positions;
+};
+
+// The stake weighted sums calculate_shares finds for each home system
+enum ShareKind 
+{
+    RESOURCE_SHARE, 
+    INFLUENCE_SHARE, 
+    RES_INF_SHARE, 
+    TECH_SHARE, 
+    N_SHARE_KINDS
+};
+
+/* Planet derived attributes of a galaxy's tiles, as parallel arrays indexed
+ * by tile id. They are filled in once as tiles are added, so scoring loops
+ * read contiguous numbers instead of going through each tile's planets
+ */
+typedef struct TileAttributes
+{
+    vector<float> resources;
+    vector<float> influence;
+    vector<float> res_inf;
+    vector<float> has_tech; // 1 if any planet has a tech specialty, else 0
+    vector<int> trait_counts[HAZARDOUS + 1]; // Planets of each PlanetTrait
+    vector<char> is_home_system;
+
+    // The same attributes as one row of SHARE_COLUMNS floats per tile for
+    // the share kernels. Column k holds the attribute summed into the
+    // ShareKind k
+    vector<float> share_rows;
+
+    void add(Tile& tile);
+} TileAttributes;
+
+/* Tiles as read from a tile json file. Galaxies copy the tiles they use, so
+ * one TileSet can be shared by any number of galaxies
+ */
+typedef struct TileSet
+{
+    list<Tile> red_tiles;
+    list<Tile> blue_tiles;
+    list<Tile> home_tiles;
+    Tile mecatol = Tile(0);
+    string digest; // content_digest of the tile file
+} TileSet;
+
+/* A galaxy shape as read from a layout json file
+ */
+typedef struct Layout
+{
+    vector<Location> valid_locations;
+    vector<pair<int, Location>> fixed_tiles; // Tile number and location
+    map<int, struct layout_info> player_setups; // Indexed by number of players
+    list<vector<Location>> warp_connections;
+    string digest; // content_digest of the layout file
+} Layout;
+
+uint64_t fnv1a_hash(const char* data, size_t size);
+string content_digest(const string& data);
+TileSet load_tiles(string tile_filename);
+Layout load_layout(string layout_filename);
+vector<string> list_layouts(string directory);
+
+// The penalties apply_penalties adds, already multiplied by their weights
+enum PenaltyKind
+{
+    HOMES_WITHOUT_PLANETS_PENALTY,
+    ADJACENT_HOMES_PENALTY,
+    ADJACENT_ANOMALIES_PENALTY,
+    ADJACENT_WORMHOLES_PENALTY,
+    MUAAT_SUPERNOVA_PENALTY,
+    CREUSS_WORMHOLE_PENALTY,
+    SAAR_ASTEROIDS_PENALTY,
+    WINNU_PATH_PENALTY,
+    N_PENALTY_KINDS
+};
+
+// Per home system shares, in the same order as Galaxy::home_systems
+typedef struct Scores
+{
+    vector<float> shares[N_SHARE_KINDS]; // Indexed by ShareKind
+    vector<float> first_turn_share;
+    vector<float> trait_counts;
+
+    float penalties[N_PENALTY_KINDS] = {}; // Indexed by PenaltyKind
+} Scores;
+
+/* How evaluate_grid scores a galaxy. Options are parsed into these fields
+ * once, so evaluation never looks one up by name
+ */
+typedef struct EvaluationConfig
+{
+    // Distance within which the race must get the system, 0 to not require
+    // it. Winnu only check whether it is set
+    int creuss_gets_wormhole = 1;
+    int muaat_gets_supernova = 1;
+    int saar_get_asteroids = 1;
+    int winnu_have_clear_path_to_mecatol = 1;
+    bool pie_slice_assignment = false;
+
+    float resource_weight = 1.0;
+    float influence_weight = 1.0;
+    float res_inf_weight = 1.0;
+    float trait_weight = 0.3;
+    float tech_weight = 1.0;
+    float first_turn = 1.0;
+    float ring_balance_weight = 1.0;
+    float res_value_of_inf = 0.667;
+    float ring_balance = 0; // 0 to not balance the rings
+
+    void set(string name, float value);
+    void validate() const;
+    json to_json() const;
+} EvaluationConfig;
+
+static map<string, int EvaluationConfig::*> evaluation_distance_key = {
+    {"creuss_gets_wormhole", &EvaluationConfig::creuss_gets_wormhole},
+    {"muaat_gets_supernova", &EvaluationConfig::muaat_gets_supernova},
+    {"saar_get_asteroids", &EvaluationConfig::saar_get_asteroids},
+    {"winnu_have_clear_path_to_mecatol", &EvaluationConfig::winnu_have_clear_path_to_mecatol}
+};
+
+static map<string, float EvaluationConfig::*> evaluation_weight_key = {
+    {"resource_weight", &EvaluationConfig::resource_weight},
+    {"influence_weight", &EvaluationConfig::influence_weight},
+    {"res_inf_weight", &EvaluationConfig::res_inf_weight},
+    {"trait_weight", &EvaluationConfig::trait_weight},
+    {"tech_weight", &EvaluationConfig::tech_weight},
+    {"first_turn", &EvaluationConfig::first_turn},
+    {"ring_balance_weight", &EvaluationConfig::ring_balance_weight},
+    {"res_value_of_inf", &EvaluationConfig::res_value_of_inf}
+};
+
+enum OptimizerStrategy {HILL_CLIMB, ANNEAL, STEEPEST_DESCENT, TABU, 
+    PARALLEL_TEMPERING, GENETIC};
+
+static map<string, OptimizerStrategy> optimizer_key = {
+    {"hill_climb", HILL_CLIMB},
+    {"anneal", ANNEAL},
+    {"steepest_descent", STEEPEST_DESCENT},
+    {"tabu", TABU},
+    {"parallel_tempering", PARALLEL_TEMPERING},
+    {"genetic", GENETIC}
+};
+
+enum TemperatureSchedule {GEOMETRIC, LINEAR};
+
+static map<string, TemperatureSchedule> schedule_key = {
+    {"geometric", GEOMETRIC},
+    {"linear", LINEAR}
+};
+
+/* Kinds of move the optimizers can make. Every move hands the tiles in some
+ * movable locations round between them: swaps exchange two tiles, cycles 
+ * rotate three, ring rotations turn a whole ring around mecatol rex by one 
+ * location and slice swaps exchange the slices of two home systems
+ */
+enum MoveType {SWAP_MOVE, CYCLE_MOVE, RING_ROTATION_MOVE, SLICE_SWAP_MOVE, 
+    N_MOVE_TYPES};
+
+static map<string, MoveType> move_type_key = {
+    {"swap", SWAP_MOVE},
+    {"cycle", CYCLE_MOVE},
+    {"ring_rotation", RING_ROTATION_MOVE},
+    {"slice_swap", SLICE_SWAP_MOVE}
+};
+
+/* One move in a MoveList. The tile in each of its locations goes to another
+ * of them, locations[first + next[first + i]] for the i'th
+ */
+typedef struct Move
+{
+    MoveType type;
+    int first;
+    int size; // Locations it touches
+} Move;
+
+/* Moves stored one after another, so that a list of thousands of them takes
+ * only a few allocations. Moves are made of locations rather than tiles, so
+ * a list stays valid however the tiles are moved
+ */
+typedef struct MoveList
+{
+    vector<Move> moves;
+    vector<Location> locations;
+    vector<int> next;
+    // Before the moves are shuffled, those of each type in order
+    int type_begin[N_MOVE_TYPES];
+    int type_end[N_MOVE_TYPES];
+
+    template <class Locations, class Next> 
+    void add(MoveType type, const Locations& move_locations, const Next& move_next) {
+        moves.push_back({type, (int) locations.size(), (int) move_locations.size()});
+        locations.insert(locations.end(), move_locations.begin(), move_locations.end());
+        next.insert(next.end(), move_next.begin(), move_next.end());
+    }
+    // Small moves are listed without building vectors for them
+    void add(MoveType type, initializer_list<Location> move_locations, 
+            initializer_list<int> move_next) {
+        add<initializer_list<Location>, initializer_list<int>>(type, 
+                move_locations, move_next);
+    }
+} MoveList;
+
+vector<MoveType> parse_move_types(string names);
+
+// Evaluation budget used by annealing and tabu search when no other limit is
+// given, since neither stops by itself. Parallel tempering gets this much for
+// each replica and the genetic algorithm for each island
+#define DEFAULT_ANNEAL_EVALUATIONS 100000
+
+// Nodes --exact may bound when no limit is given, since on most layouts it
+// would never finish
+#define DEFAULT_EXACT_EVALUATIONS 100000
+
+/* How optimize_grid searches for a better galaxy and when it has to stop
+ */
+typedef struct OptimizerOptions
+{
+    OptimizerStrategy strategy = HILL_CLIMB;
+    long max_evaluations = 0; // 0 for no limit
+    int time_limit_ms = 0; // 0 for no limit
+    int n_threads = 1; // Threads a single optimization may use
+    bool verbose = true; // Print every swap that improves the score
+    ConvergenceTrace* trace = NULL; // Records every move made, if set
+    // Tried by every strategy but the genetic algorithm, which only swaps
+    vector<MoveType> moves = {SWAP_MOVE};
+
+    // Hard deadline shared by every restart of a request. Unlike the limits
+    // above it does not scale the annealing schedule, the search just stops 
+    // on the best grid it has found so far
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+
+    // Simulated annealing, and the hottest and coldest chains of parallel
+    // tempering
+    TemperatureSchedule schedule = GEOMETRIC;
+    float start_temperature = 0.05;
+    float end_temperature = 0.0005;
+
+    // Parallel tempering only
+    int n_replicas = 8;
+    long exchange_interval = 200; // Steps each chain makes between exchanges
+
+    // Genetic algorithm only
+    int n_islands = 4;
+    int population = 16; // On each island
+    int migration_interval = 10; // Generations between migrations
+    int mutation_swaps = 10; // Tried on each child
+
+    // After the strategy, search every placement by branch and bound for a
+    // better grid, until none can exist or a limit is hit. Its nodes count
+    // towards max_evaluations
+    bool exact = false;
+
+    // Tabu search only: moves before a swapped pair of tiles may be swapped back
+    int tabu_tenure = 30;
+} OptimizerOptions;
+
+// Why an optimization stopped. CONVERGED when no limit cut it short
+enum StopReason {CONVERGED, EVALUATION_LIMIT, TIME_LIMIT, DEADLINE};
+
+// The clock is only read once every this many evaluations
+#define CLOCK_CHECK_INTERVAL 16
+
+/* Keeps track of how much of the evaluation and time budget of an 
+ * optimization has been used
+ */
+class SearchBudget
+{
+    chrono::steady_clock::time_point start;
+    chrono::steady_clock::time_point deadline;
+    long max_evaluations;
+    int time_limit_ms;
+    float elapsed = 0; // ms, as of the last clock check
+    long next_clock_check = 0;
+
+    public:
+    long n_evaluations = 0;
+    StopReason stop_reason = CONVERGED;
+
+    SearchBudget(long max_evaluations, int time_limit_ms, 
+            chrono::steady_clock::time_point deadline);
+    float elapsed_ms();
+    bool is_exhausted();
+    float fraction_used();
+    SearchBudget share(long max_evaluations, int n_shares);
+};
+
+/* How far the branch and bound of --exact got. No placement of the movable
+ * systems scores below lower_bound, which is the score of the grid found
+ * once it is proven optimal
+ */
+typedef struct ExactResult
+{
+    bool searched = false;
+    bool proven = false;
+    float lower_bound = 0;
+    float unavoidable_penalty = 0; // Paid by every placement
+    long nodes = 0; // Partial placements bounded
+} ExactResult;
+
+// Parts of generating a galaxy that --stats times separately
+enum StatsPhase 
+{
+    IMPORT_PHASE, 
+    INITIALIZE_GRID_PHASE, 
+    DISTANCES_PHASE, 
+    STAKES_PHASE, 
+    SHARES_PHASE, 
+    PENALTIES_PHASE, 
+    WRITE_JSON_PHASE, 
+    N_STATS_PHASES
+};
+
+/* Counters kept while generating a galaxy. Counting costs an addition and is
+ * always done. The phases are only timed when timed is set, since the hot
+ * ones run for well under a microsecond and reading the clock is not free
+ */
+typedef struct GeneratorStats
+{
+    bool timed = false;
+    double phase_ms[N_STATS_PHASES] = {};
+    double optimize_ms = 0;
+    long evaluations = 0;
+    long swaps_tried = 0;
+    long swaps_accepted = 0;
+    long nodes_expanded = 0; // Locations settled when finding distances
+
+    void add(const GeneratorStats& other);
+    json to_json() const;
+} GeneratorStats;
+
+/* Adds the time until it goes out of scope to a phase, if stats are timed
+ */
+class PhaseTimer
+{
+    GeneratorStats& stats;
+    StatsPhase phase;
+    chrono::steady_clock::time_point start;
+
+    public:
+    PhaseTimer(GeneratorStats& stats, StatsPhase phase) 
+        : stats(stats), phase(phase) {
+        if (stats.timed) {
+            start = chrono::steady_clock::now();
+        }
+    }
+    ~PhaseTimer() {
+        if (stats.timed) {
+            stats.phase_ms[phase] += chrono::duration<double, milli>(
+                    chrono::steady_clock::now() - start).count();
+        }
+    }
+};
+
+class Galaxy
+{
+    list<Tile> tiles;
+    vector<Tile*> tiles_by_id;
+    TileAttributes tile_attributes;
+    // Locations of tiles, row by row in one array. A border of boundary_tile
+    // cells surrounds the galaxy, so every hex neighbour of a location in the
+    // layout is a valid index and neighbours are found by adding a constant
+    // offset. See get_cell_index
+    vector<Tile*> grid;
+    int grid_rows = 0;
+    int grid_columns = 0; // Both without the border
+    Tile *mecatol;
+    vector<Tile*> home_systems;
+    list<Tile*> movable_systems;
+    list<Tile*> placed_tiles;
+    list<Tile*> red_tiles;
+    list<Tile*> blue_tiles;
+    vector<vector<Tile*>> wormhole_systems; // Placed tiles, indexed by Wormhole
+    Tile boundary_tile; // used for inaccesable locations in the grid
+    mt19937 rng;
+    int restart; // Which of the galaxies generated from one seed this is
+    EvaluationConfig evaluation_config;
+    list<vector<Location>> warp_connections;
+
+    // Compressed sparse row adjacency between grid locations, built once per
+    // layout from the hex neighbours and warp lanes. The neighbours of the 
+    // location with cell index c are the cells adjacent_cells[adjacency_offsets[c]]
+    // up to adjacent_cells[adjacency_offsets[c + 1]]. Swapping tiles only
+    // changes which tiles sit in those cells, so nothing here needs to be
+    // rebuilt
+    vector<int> adjacency_offsets;
+    vector<int> adjacent_cells;
+
+    // Every valid location numbered as a slot of the bitboards (-1 for cells
+    // outside the galaxy). Small galaxies use the bitboard with the narrowest
+    // mask that fits every slot to find distances
+    vector<int> cell_slots;
+    int n_slots = 0;
+    Bitboard<uint64_t> small_bitboard;
+    Bitboard<__uint128_t> large_bitboard;
+
+    // Scratch space for distance_to_other_tiles
+    vector<int> path_lengths;
+    vector<vector<int>> distance_buckets;
+    Scores scores;
+    TileMatrix stakes;
+
+    // Results of the last evaluation, reused to score swaps incrementally
+    TileMatrix home_distances;
+    vector<float> mecatol_distances;
+    float grid_score;
+
+    // How the last optimize_grid went
+    StopReason stop_reason = CONVERGED;
+    long n_evaluations = 0;
+    GeneratorStats stats;
+    ExactResult exact_result;
+
+    // Everything needed to roll back the move made by try_swap or try_move
+    struct PendingMove
+    {
+        vector<Tile*> tiles; // tiles[i] went to where tiles[next[i]] was
+        vector<int> next;
+        vector<Location> locations; // Of the tiles before the move
+        bool full_evaluation = false;
+        TileMatrix home_distances;
+        vector<float> mecatol_distances;
+        TileMatrix stakes;
+        // Distances to and stakes in the tiles before the move, 
+        // [hs * tiles.size() + i]
+        vector<float> tile_distances;
+        vector<float> tile_mecatol_distances;
+        vector<float> tile_stakes;
+        Scores scores;
+        float score;
+    } pending_move;
+
+    Tile* add_tile(Tile tile);
+    void import_tiles(const TileSet& tile_set);
+    struct layout_info import_layout(const Layout& layout, int n_players);
+    void random_home_tiles(int n);
+    void dummy_home_tiles(int n);
+    void chosen_home_tiles(string chosen);
+    void initialize_grid(struct layout_info layout_info, string mandatory_tile_numbers, bool star_by_star);
+    void place_tile(Location location, Tile*);
+    void swap_tiles(Tile *, Tile *);
+    int count_home_systems_without_planets();
+    int count_adjacent_anomalies();
+    int count_adjacent_home_systems();
+    int count_adjacent_wormholes();
+    Tile* get_tile_at(Location location);
+    Tile* get_tile_by_number(int n);
+    bool is_valid_location(Location location);
+    int get_cell_index(Location location);
+    void build_adjacency();
+    template <class Mask> void build_bitboard(Bitboard<Mask>& bitboard);
+    template <class Mask> void bitboard_distances(Bitboard<Mask>& bitboard, 
+            Tile* t1, float* distances);
+    void index_wormhole_systems();
+    vector<Tile*> get_adjacent(Tile* t1, bool go_through_wormholes = true);
+    template <class Visit> void for_each_adjacent(Tile* t1, 
+            bool go_through_wormholes, Visit visit);
+    void distance_to_other_tiles(Tile* t1, float* distances);
+    void dial_distances(Tile* t1, float* distances);
+    void calculate_tile_stakes(Tile* t, const TileMatrix& distances, TileMatrix& stakes);
+    void split_stake(int id, bool may_pie_slice, const TileMatrix& distances, 
+            TileMatrix& stakes);
+    void calculate_stakes(const TileMatrix& distances, TileMatrix& stakes);
+    void calculate_shares(const TileMatrix& stakes, Scores& scores);
+    float apply_penalties(const TileMatrix& distances);
+    float calculate_trait_variance(const TileMatrix& stakes, Scores& scores);
+    float first_turn_variance(const TileMatrix& stakes, Scores& scores);
+    float calculate_ring_balance(const vector<float>& distances_from_mecatol);
+    float score_grid();
+    bool swap_changes_distances(Tile* a, Tile* b);
+    void add_tile_shares(Tile* t, float sign);
+    float try_swap(Tile* a, Tile* b);
+    float try_move(const MoveList& list, const Move& move);
+    float try_pending_move();
+    void accept_swap();
+    void reject_swap();
+    void make_move_list(const OptimizerOptions& options, MoveList& list);
+    float try_random_move(const OptimizerOptions& options, const MoveList& list,
+            const vector<Tile*>& movable);
+    void trace_pending_move(const OptimizerOptions& options, 
+            const SearchBudget& budget, float current_score, float best_score);
+    void print_pending_move(float new_score);
+    vector<Location> get_placement();
+    void set_placement(const vector<Location>& placement);
+    void hill_climb(const OptimizerOptions& options, SearchBudget& budget);
+    void anneal(const OptimizerOptions& options, SearchBudget& budget);
+    void steepest_descent(const OptimizerOptions& options, SearchBudget& budget);
+    void tabu_search(const OptimizerOptions& options, SearchBudget& budget);
+    bool anneal_step(float temperature);
+    long anneal_chain(const OptimizerOptions& options, const MoveList& moves, 
+            float temperature, long n_evaluations, SearchBudget& budget, 
+            float& best_score, vector<Location>& best_placement);
+    void parallel_tempering(const OptimizerOptions& options, SearchBudget& budget);
+    struct Island;
+    float place_genes(const vector<Location>& placement, const vector<int>& genes);
+    void breed(Island& island, const OptimizerOptions& options, 
+            const vector<Location>& placement);
+    void genetic(const OptimizerOptions& options, SearchBudget& budget);
+    // Branch and bound, see exact_search.cpp
+    struct ExactSearch;
+    void exact_place_specials(ExactSearch& search, vector<int>& tile_at, 
+            vector<int>& special_slots, int depth, float bound, 
+            SearchBudget& budget);
+    void exact_place_normals(ExactSearch& search, vector<int>& tile_at, 
+            SearchBudget& budget);
+    void branch_and_bound(const OptimizerOptions& options, long max_evaluations,
+            SearchBudget& budget);
+    void trace_move(const OptimizerOptions& options, const SearchBudget& budget,
+            float current_score, float best_score, Tile* a = NULL, Tile* b = NULL);
+    int get_home_system_index(int tile_number);
+    bool is_wormhole_near_creuss(int near_dist, const TileMatrix& distances);
+    bool is_supernova_near_muaat(int near_dist, const TileMatrix& distances);
+    bool is_asteroid_near_saar(int near_dist, const TileMatrix& distances);
+    bool winnu_have_clear_path_to_mecatol(const TileMatrix& distances);
+
+    // A plain copy still points at the original's tiles, use clone
+    Galaxy(const Galaxy&) = default;
+    void relink_tiles(const Galaxy& original);
+
+    // Time and check the private parts of the evaluation, see ti4-bench.cpp
+    friend class GalaxyBenchmark;
+    friend class GalaxyCheck;
+
+    public:
+    Galaxy(string tile_filename, string layout_filename, int n_players, 
+            HomeSystemSetups, string home_tile_ids, 
+            string mandatory_tile_numbers, bool star_by_star,
+            unsigned int seed, int restart = 0);
+    Galaxy(const TileSet& tile_set, const Layout& layout, int n_players, 
+            HomeSystemSetups, string home_tile_ids, 
+            string mandatory_tile_numbers, bool star_by_star,
+            unsigned int seed, int restart = 0);
+    Galaxy* clone() const;
+    void print_grid();
+    void print_distances_from(int);
+    void set_evaluation_config(const EvaluationConfig& config);
+    float evaluate_grid();
+    void optimize_grid(OptimizerOptions options = OptimizerOptions());
+    StopReason get_stop_reason() {return stop_reason;};
+    void set_stop_reason(StopReason reason) {stop_reason = reason;};
+    GeneratorStats& get_stats() {return stats;};
+    const ExactResult& get_exact_result() {return exact_result;};
+    json to_json();
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <cerrno>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "result_cache.hpp"
+
+ResultCache::ResultCache(string directory, long max_bytes)
+    : directory(directory), max_bytes(max_bytes)
+{
+    if (mkdir(directory.c_str(), 0755) and errno != EEXIST) {
+        cerr << "Could not create cache directory " << directory << endl;
+        exit(-1);
+    }
+}
+
+string ResultCache::entry_path(const string& key)
+{
+    return directory + "/" + key + ".json";
+}
+
+/* Reads the entry for key into result if there is one, and marks it as just
+ * used
+ */
+bool ResultCache::lookup(const string& key, json& result)
+{
+    string path = entry_path(key);
+    ifstream entry(path);
+    if (not entry) {
+        return false;
+    }
+    try {
+        entry >> result;
+    } catch (...) {
+        return false;
+    }
+    utime(path.c_str(), NULL);
+    return true;
+}
+
+/* Writes the entry to a temporary file first and renames it into place,
+ * which replaces any existing entry in one step
+ */
+void ResultCache::store(const string& key, const json& result)
+{
+    stringstream temporary;
+    temporary << entry_path(key) << ".tmp." << getpid() << "."
+        << hash<thread::id>()(this_thread::get_id());
+    string temporary_path = temporary.str();
+
+    ofstream entry(temporary_path);
+    entry << result;
+    entry.close();
+    if (not entry or rename(temporary_path.c_str(), entry_path(key).c_str())) {
+        unlink(temporary_path.c_str());
+        return;
+    }
+    evict();
+}
+
+/* Removes the entries used longest ago until the cache fits in max_bytes
+ */
+void ResultCache::evict()
+{
+    lock_guard<mutex> lock(eviction_mutex);
+
+    struct Entry
+    {
+        string path;
+        time_t last_used;
+        long size;
+    };
+    vector<Entry> entries;
+    long total_bytes = 0;
+
+    DIR* dir = opendir(directory.c_str());
+    if (not dir) {
+        return;
+    }
+    while (struct dirent* dir_entry = readdir(dir)) {
+        string name = dir_entry->d_name;
+        if (name.size() <= 5 or name.substr(name.size() - 5) != ".json") {
+            continue;
+        }
+        string path = directory + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info)) {
+            continue;
+        }
+        entries.push_back({path, info.st_mtime, (long) info.st_size});
+        total_bytes += info.st_size;
+    }
+    closedir(dir);
+
+    if (total_bytes <= max_bytes) {
+        return;
+    }
+    sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.last_used < b.last_used;
+    });
+    for (auto& entry : entries) {
+        if (total_bytes <= max_bytes) {
+            break;
+        }
+        unlink(entry.path.c_str());
+        total_bytes -= entry.size;
+    }
+}
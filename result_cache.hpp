@@ -0,0 +1,32 @@
+#ifndef TI4_RESULT_CACHE_HPP
+#define TI4_RESULT_CACHE_HPP
+
+#include <string>
+#include <mutex>
+
+#include "json.hpp"
+
+using json = nlohmann::json;
+using namespace std;
+
+/* Generation results stored on disk as one json file per request, named by
+ * the hash of the request. Entries are written atomically, so readers in
+ * other processes never see half a file, and the least recently used
+ * entries are removed once the cache grows past max_bytes
+ */
+class ResultCache
+{
+    string directory;
+    long max_bytes;
+    mutex eviction_mutex;
+
+    string entry_path(const string& key);
+    void evict();
+
+    public:
+    ResultCache(string directory, long max_bytes);
+    bool lookup(const string& key, json& result);
+    void store(const string& key, const json& result);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "share_kernels.hpp"
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so this needs no check. Each row takes two registers
+static void share_kernel_sse2(const float* attributes, const float* stakes,
+        int n_tiles, int stride, int n_home_systems, float* const* shares,
+        int n_shares)
+{
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        const float* hs_stakes = stakes + hs * stride;
+        __m128 low = _mm_setzero_ps();
+        __m128 high = _mm_setzero_ps();
+        for (int id = 0; id < n_tiles; id++) {
+            const float* row = attributes + id * SHARE_COLUMNS;
+            __m128 stake = _mm_set1_ps(hs_stakes[id]);
+            low = _mm_add_ps(low, _mm_mul_ps(_mm_loadu_ps(row), stake));
+            high = _mm_add_ps(high, _mm_mul_ps(_mm_loadu_ps(row + 4), stake));
+        }
+        float sums[SHARE_COLUMNS];
+        _mm_storeu_ps(sums, low);
+        _mm_storeu_ps(sums + 4, high);
+        for (int k = 0; k < n_shares; k++) {
+            shares[k][hs] = sums[k];
+        }
+    }
+}
+
+// Only avx2 is enabled, not fma, so the compiler cannot fuse the multiply
+// and add and change the rounding
+__attribute__((target("avx2")))
+static void share_kernel_avx2(const float* attributes, const float* stakes,
+        int n_tiles, int stride, int n_home_systems, float* const* shares,
+        int n_shares)
+{
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        const float* hs_stakes = stakes + hs * stride;
+        __m256 sum = _mm256_setzero_ps();
+        for (int id = 0; id < n_tiles; id++) {
+            __m256 row = _mm256_loadu_ps(attributes + id * SHARE_COLUMNS);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(row,
+                        _mm256_set1_ps(hs_stakes[id])));
+        }
+        float sums[SHARE_COLUMNS];
+        _mm256_storeu_ps(sums, sum);
+        for (int k = 0; k < n_shares; k++) {
+            shares[k][hs] = sums[k];
+        }
+    }
+}
+
+static ShareKernel select_share_kernel()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return share_kernel_avx2;
+    }
+    return share_kernel_sse2;
+}
+
+const ShareKernel share_kernel = select_share_kernel();
+
+const char* share_kernel_name()
+{
+    return share_kernel == share_kernel_avx2 ? "avx2" : "sse2";
+}
+
+#else
+
+static void share_kernel_scalar(const float* attributes, const float* stakes,
+        int n_tiles, int stride, int n_home_systems, float* const* shares,
+        int n_shares)
+{
+    for (int hs = 0; hs < n_home_systems; hs++) {
+        const float* hs_stakes = stakes + hs * stride;
+        float sums[SHARE_COLUMNS] = {};
+        for (int id = 0; id < n_tiles; id++) {
+            const float* row = attributes + id * SHARE_COLUMNS;
+            for (int k = 0; k < n_shares; k++) {
+                sums[k] += row[k] * hs_stakes[id];
+            }
+        }
+        for (int k = 0; k < n_shares; k++) {
+            shares[k][hs] = sums[k];
+        }
+    }
+}
+
+const ShareKernel share_kernel = share_kernel_scalar;
+
+const char* share_kernel_name()
+{
+    return "scalar";
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef TI4_SHARE_KERNELS_HPP
+#define TI4_SHARE_KERNELS_HPP
+
+// Floats in each tile's row of share attributes, padded to fill an AVX
+// register
+#define SHARE_COLUMNS 8
+
+/* Computes every home system's shares of the galaxy in one pass over the
+ * stakes: shares[k][hs] is the sum over tiles of attributes[id][k] times
+ * stakes[hs][id], for the first n_shares columns. attributes holds n_tiles
+ * rows of SHARE_COLUMNS floats and stakes n_home_systems rows of stride
+ * floats. Each share is summed in tile id order without fused multiply-adds,
+ * so every kernel gives the same result bit for bit
+ */
+typedef void (*ShareKernel)(const float* attributes, const float* stakes,
+        int n_tiles, int stride, int n_home_systems, float* const* shares,
+        int n_shares);
+
+// The fastest kernel the cpu supports, chosen when the program starts
+extern const ShareKernel share_kernel;
+const char* share_kernel_name();
+
+#endif
@@ -9,10 +9,22 @@ import sys
 import subprocess
 import draw_galaxy
 import json
+import socket
 from glob import glob
 
 GENERATED_DIR = "../generated"
+RESULT_CACHE_DIR = os.path.join(GENERATED_DIR, "cache")
+# Built with ./ti4-map-generator --compile_db ../generated/tiles.db -t tiles.json
+TILE_DATABASE = os.path.join(GENERATED_DIR, "tiles.db")
 LAYOUTS_DIR = "../res/layouts"
+# Stop optimizing well before the gateway gives up on us, the generator
+# still writes the best galaxy it found
+GENERATOR_DEADLINE_MS = 20000
+# Unix socket of a running "ti4-map-generator --serve", used instead of
+# starting a new generator process when it exists
+GENERATOR_SOCKET = "/tmp/ti4-map-generator.sock"
+SHORT_OPTIONS = {"-t": "tiles", "-l": "layout", "-o": "output",
+                 "-p": "players", "-s": "seed", "-r": "races"}
 
 def spiral_pattern(centre):
     cur_point = centre
@@ -38,6 +50,61 @@ def remove_other_chars(s, allowed):
     return ''.join(c for c in s if c in allowed)
 
 
+def command_to_request(cmd):
+    request = {}
+    i = 1
+    while i < len(cmd):
+        name = SHORT_OPTIONS.get(cmd[i], cmd[i].lstrip("-"))
+        if i + 1 < len(cmd) and not cmd[i + 1].startswith("-"):
+            request[name] = cmd[i + 1]
+            i += 2
+        else:
+            request[name] = True
+            i += 1
+    return request
+
+
+def request_galaxy(cmd):
+    request = command_to_request(cmd)
+    output_filename = request.pop("output")
+    request.pop("tiles")
+
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(GENERATOR_SOCKET)
+    s.sendall(json.dumps(request) + "\n")
+    response = ""
+    while not response.endswith("\n"):
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        response += chunk
+    s.close()
+
+    response = json.loads(response)
+    if "error" in response:
+        raise Exception(response["error"])
+    with open(output_filename, "w") as f:
+        json.dump(response["galaxy"], f)
+
+
+def run_generator(cmd):
+    if os.path.exists(GENERATOR_SOCKET):
+        try:
+            return request_galaxy(cmd)
+        except socket.error:
+            pass
+
+    cmd = cmd + ["--cache", RESULT_CACHE_DIR]
+    if os.path.exists(TILE_DATABASE):
+        cmd += ["--db", TILE_DATABASE]
+    p = subprocess.Popen(cmd,
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    p.wait()
+    out, err = p.communicate()
+    if p.returncode:
+        raise Exception(err)
+
+
 def generate_galaxy(args):
 
     if "display_type" in args:
@@ -72,7 +139,8 @@ def generate_galaxy(args):
            "-l", args["layout"].value,
            "-o", os.path.join(GENERATED_DIR, galaxy_json_filename),
            "-p", str(n_players),
-           "-s", str(seed)]
+           "-s", str(seed),
+           "--deadline_ms", str(GENERATOR_DEADLINE_MS)]
 
     if "race_selection_method" in args:
         if args["race_selection_method"].value == "random":
@@ -130,12 +198,7 @@ def generate_galaxy(args):
     if "ring_balance" in args and "use_ring_balance" in args and args["use_ring_balance"].value == "true":
         cmd += ["--ring_balance", str(float(args["ring_balance"].value))]
 
-    p = subprocess.Popen(cmd,
-        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    p.wait()
-    out, err = p.communicate()
-    if p.returncode:
-        raise Exception(err)
+    run_generator(cmd)
 
     string = draw_galaxy.create_galaxy_image(
         os.path.join(GENERATED_DIR, galaxy_json_filename),
@@ -0,0 +1,414 @@
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <new>
+
+#include "cxxopts.hpp"
+
+#include "galaxy.hpp"
+
+/* Every heap allocation made by the program is counted, so that benchmarks
+ * can report how many allocations each operation makes
+ */
+static atomic<long> n_allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    n_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (not p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+typedef struct BenchmarkResult
+{
+    long iterations = 0;
+    double ns_per_op = 0;
+    double allocations_per_op = 0;
+} BenchmarkResult;
+
+/* Calls op in ever larger batches until min_time_ms have been spent in
+ * total, so that reading the clock does not distort very short operations.
+ * op is called once before timing starts to size any scratch space
+ */
+template <class Op>
+BenchmarkResult run_benchmark(Op op, double min_time_ms)
+{
+    op();
+
+    BenchmarkResult result;
+    double elapsed_ns = 0;
+    long allocations = 0;
+    for (long batch = 1; elapsed_ns < min_time_ms * 1e6; batch *= 2) {
+        long allocations_before = n_allocations;
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < batch; i++) {
+            op();
+        }
+        elapsed_ns += chrono::duration<double, nano>(
+                chrono::steady_clock::now() - start).count();
+        allocations += n_allocations - allocations_before;
+        result.iterations += batch;
+    }
+    result.ns_per_op = elapsed_ns / result.iterations;
+    result.allocations_per_op = (double) allocations / result.iterations;
+    return result;
+}
+
+/* Times the parts of the evaluation on one galaxy. It is a friend of Galaxy
+ * so that the private scoring functions can be called directly
+ */
+class GalaxyBenchmark
+{
+    Galaxy& galaxy;
+    double min_time_ms;
+
+    public:
+    GalaxyBenchmark(Galaxy& galaxy, double min_time_ms)
+        : galaxy(galaxy), min_time_ms(min_time_ms) {};
+    BenchmarkResult distance_to_other_tiles();
+    BenchmarkResult get_adjacent();
+    BenchmarkResult calculate_stakes();
+    BenchmarkResult calculate_shares();
+    BenchmarkResult evaluate_grid();
+    BenchmarkResult optimize_grid(OptimizerOptions options, long& n_evaluations);
+};
+
+// One call from each home system in turn
+BenchmarkResult GalaxyBenchmark::distance_to_other_tiles()
+{
+    vector<float> distances(galaxy.tiles_by_id.size());
+    int hs = 0;
+    return run_benchmark([&]() {
+        galaxy.distance_to_other_tiles(galaxy.home_systems[hs], distances.data());
+        hs = (hs + 1) % galaxy.home_systems.size();
+    }, min_time_ms);
+}
+
+// One call for each placed tile in turn
+BenchmarkResult GalaxyBenchmark::get_adjacent()
+{
+    vector<Tile*> placed(galaxy.placed_tiles.begin(), galaxy.placed_tiles.end());
+    int i = 0;
+    return run_benchmark([&]() {
+        galaxy.get_adjacent(placed[i]);
+        i = (i + 1) % placed.size();
+    }, min_time_ms);
+}
+
+BenchmarkResult GalaxyBenchmark::calculate_stakes()
+{
+    galaxy.evaluate_grid();
+    TileMatrix stakes;
+    return run_benchmark([&]() {
+        galaxy.calculate_stakes(galaxy.home_distances, stakes);
+    }, min_time_ms);
+}
+
+BenchmarkResult GalaxyBenchmark::calculate_shares()
+{
+    galaxy.evaluate_grid();
+    Scores scores;
+    return run_benchmark([&]() {
+        galaxy.calculate_shares(galaxy.stakes, scores);
+    }, min_time_ms);
+}
+
+BenchmarkResult GalaxyBenchmark::evaluate_grid()
+{
+    return run_benchmark([&]() {
+        galaxy.evaluate_grid();
+    }, min_time_ms);
+}
+
+/* Optimizes fresh clones of the galaxy, so every run starts from the same
+ * grid. Only the optimization itself is timed. n_evaluations is set to the
+ * number of grids each run scores
+ */
+BenchmarkResult GalaxyBenchmark::optimize_grid(OptimizerOptions options,
+        long& n_evaluations)
+{
+    BenchmarkResult result;
+    double elapsed_ns = 0;
+    long allocations = 0;
+    while (not result.iterations or elapsed_ns < min_time_ms * 1e6) {
+        unique_ptr<Galaxy> copy(galaxy.clone());
+        long allocations_before = n_allocations;
+        auto start = chrono::steady_clock::now();
+        copy->optimize_grid(options);
+        elapsed_ns += chrono::duration<double, nano>(
+                chrono::steady_clock::now() - start).count();
+        allocations += n_allocations - allocations_before;
+        n_evaluations = copy->n_evaluations;
+        result.iterations++;
+    }
+    result.ns_per_op = elapsed_ns / result.iterations;
+    result.allocations_per_op = (double) allocations / result.iterations;
+    return result;
+}
+
+// Largest difference allowed between an incremental and a full score
+#define CHECK_TOLERANCE 1e-3
+
+// How far apart two distances are, where two UNREACHABLE ones agree
+static float distance_difference(float a, float b)
+{
+    return a == b ? 0 : fabs(a - b);
+}
+
+typedef struct CheckResult
+{
+    long moves = 0;
+    long full_evaluations = 0; // Moves that changed the paths
+    long accepted = 0;
+    float max_score_error = 0;
+    float max_distance_error = 0;
+
+    bool passed() const {
+        return max_score_error <= CHECK_TOLERANCE and max_distance_error == 0;
+    }
+} CheckResult;
+
+/* Checks the incremental scoring of moves against a full evaluate_grid, and
+ * the bitboard distances against dial_distances, over random moves of every
+ * kind. It is a friend of Galaxy for the same reason as GalaxyBenchmark
+ */
+class GalaxyCheck
+{
+    Galaxy& galaxy;
+
+    float distance_error(Galaxy& moved, Galaxy& reference);
+
+    public:
+    GalaxyCheck(Galaxy& galaxy) : galaxy(galaxy) {};
+    CheckResult check_moves(long n_moves);
+};
+
+/* Largest difference between dial_distances on reference and its bitboards,
+ * and between dial_distances and the distances moved has carried over from 
+ * move to move
+ */
+float GalaxyCheck::distance_error(Galaxy& moved, Galaxy& reference)
+{
+    // Only the bitboard in use is kept up to date as tiles move
+    if (reference.n_slots <= 64) {
+        reference.build_bitboard(reference.large_bitboard);
+    }
+
+    int n_tiles = reference.tiles_by_id.size();
+    vector<float> dial(n_tiles);
+    vector<float> bitboard(n_tiles);
+    float error = 0;
+    auto compare = [&](const float* distances) {
+        for (int id = 0; id < n_tiles; id++) {
+            error = MAX(error, distance_difference(dial[id], distances[id]));
+        }
+    };
+    for (int hs = 0; hs <= (int) reference.home_systems.size(); hs++) {
+        bool is_mecatol = hs == (int) reference.home_systems.size();
+        Tile* source = is_mecatol ? reference.mecatol : reference.home_systems[hs];
+        reference.dial_distances(source, dial.data());
+        if (reference.n_slots <= 64) {
+            reference.bitboard_distances(reference.small_bitboard, source, 
+                    bitboard.data());
+            compare(bitboard.data());
+        }
+        if (reference.n_slots <= 128) {
+            reference.bitboard_distances(reference.large_bitboard, source, 
+                    bitboard.data());
+            compare(bitboard.data());
+        }
+        compare(is_mecatol ? moved.mecatol_distances.data() 
+                : moved.home_distances[hs]);
+    }
+    return error;
+}
+
+/* Makes n_moves random moves on a clone of the galaxy, accepting half of
+ * them, and scores each from scratch on a second clone given the same 
+ * placement
+ */
+CheckResult GalaxyCheck::check_moves(long n_moves)
+{
+    unique_ptr<Galaxy> moved(galaxy.clone());
+    unique_ptr<Galaxy> reference(galaxy.clone());
+    OptimizerOptions options;
+    options.moves = {SWAP_MOVE, CYCLE_MOVE, RING_ROTATION_MOVE, SLICE_SWAP_MOVE};
+    MoveList moves;
+    moved->make_move_list(options, moves);
+    vector<Tile*> movable(moved->movable_systems.begin(), 
+            moved->movable_systems.end());
+
+    CheckResult result;
+    float score = moved->evaluate_grid();
+    if (movable.size() < 2) {
+        return result;
+    }
+    bernoulli_distribution accept(0.5);
+    while (result.moves < n_moves) {
+        float new_score = moved->try_random_move(options, moves, movable);
+        if (isnan(new_score)) {
+            continue;
+        }
+        result.moves++;
+        if (moved->pending_move.full_evaluation) {
+            result.full_evaluations++;
+        }
+
+        reference->set_placement(moved->get_placement());
+        float full_score = reference->evaluate_grid();
+        result.max_score_error = MAX(result.max_score_error, 
+                fabs(new_score - full_score));
+        result.max_distance_error = MAX(result.max_distance_error, 
+                distance_error(*moved, *reference));
+
+        if (accept(moved->rng)) {
+            moved->accept_swap();
+            result.accepted++;
+            score = new_score;
+        } else {
+            moved->reject_swap();
+            result.max_score_error = MAX(result.max_score_error, 
+                    fabs(moved->grid_score - score));
+        }
+    }
+    return result;
+}
+
+vector<int> supported_player_counts(string layout_filename)
+{
+    ifstream layout_file(layout_filename);
+    json j;
+    layout_file >> j;
+
+    vector<int> player_counts;
+    for (auto it = j["home_tile_positions"].begin();
+            it != j["home_tile_positions"].end(); ++it) {
+        player_counts.push_back(stoi(it.key()));
+    }
+    return player_counts;
+}
+
+/* Writes one json object per line, so results can be compared with any
+ * json tool
+ */
+void print_result(string layout, int n_players, string benchmark,
+        BenchmarkResult result, long evaluations_per_op)
+{
+    json j;
+    j["layout"] = layout;
+    j["players"] = n_players;
+    j["benchmark"] = benchmark;
+    j["share_kernel"] = share_kernel_name();
+    j["iterations"] = result.iterations;
+    j["ns_per_op"] = result.ns_per_op;
+    j["allocations_per_op"] = result.allocations_per_op;
+    if (evaluations_per_op) {
+        j["evaluations_per_second"] = evaluations_per_op * 1e9 / result.ns_per_op;
+        j["allocations_per_evaluation"] =
+            result.allocations_per_op / evaluations_per_op;
+    }
+    cout << j << endl;
+}
+
+void print_check_result(string layout, int n_players, CheckResult result)
+{
+    json j;
+    j["layout"] = layout;
+    j["players"] = n_players;
+    j["check"] = "incremental_evaluation";
+    j["moves"] = result.moves;
+    j["full_evaluations"] = result.full_evaluations;
+    j["accepted"] = result.accepted;
+    j["max_score_error"] = result.max_score_error;
+    j["max_distance_error"] = result.max_distance_error;
+    j["passed"] = result.passed();
+    cout << j << endl;
+}
+
+int main(int argc, char *argv[]) {
+
+    cxxopts::Options options("ti4-bench",
+            "Time the galaxy evaluation on every layout");
+    options.add_options()
+            ("h,help", "Print help")
+            ("t,tiles", "json file defining tile properites", cxxopts::value<string>()->default_value("site/cgi-bin/tiles.json"))
+            ("layouts", "directory of layouts to benchmark", cxxopts::value<string>()->default_value("site/res/layouts"))
+            ("s,seed", "random seed used for every galaxy", cxxopts::value<int>()->default_value("1"))
+            ("min_time_ms", "minimum time to spend on each benchmark", cxxopts::value<double>()->default_value("200"))
+            ("optimizer", "search strategy timed by the optimize_grid benchmark: hill_climb, anneal, steepest_descent, tabu, parallel_tempering or genetic", cxxopts::value<string>()->default_value("hill_climb"))
+            ("moves", "comma separated kinds of move the optimizer tries: swap, cycle, ring_rotation and slice_swap", cxxopts::value<string>()->default_value("swap"))
+            ("check", "instead of timing, make this many random moves of every kind on each galaxy, checking the incremental scores against a full evaluation and the bitboard distances against Dial's algorithm. Exits with an error if any disagree", cxxopts::value<long>()->default_value("0"))
+            ;
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help")) {
+        cout << options.help() << endl;
+        exit(0);
+    }
+
+    OptimizerOptions optimizer_options;
+    optimizer_options.verbose = false;
+    try {
+        optimizer_options.strategy = optimizer_key.at(result["optimizer"].as<string>());
+    } catch (const out_of_range&) {
+        cerr << "Unknown optimizer" << endl;
+        exit(-1);
+    }
+    try {
+        optimizer_options.moves = parse_move_types(result["moves"].as<string>());
+    } catch (invalid_argument& e) {
+        cerr << e.what() << endl;
+        exit(-1);
+    }
+
+    string tiles = result["tiles"].as<string>();
+    int seed = result["seed"].as<int>();
+    double min_time_ms = result["min_time_ms"].as<double>();
+    long n_check_moves = result["check"].as<long>();
+
+    bool passed = true;
+    for (auto layout : list_layouts(result["layouts"].as<string>())) {
+        string name = layout.substr(layout.rfind('/') + 1);
+        for (int n_players : supported_player_counts(layout)) {
+            Galaxy galaxy(tiles, layout, n_players, RANDOM_RACES, "", "",
+                    false, seed);
+            if (n_check_moves) {
+                CheckResult check_result = 
+                    GalaxyCheck(galaxy).check_moves(n_check_moves);
+                print_check_result(name, n_players, check_result);
+                passed = passed and check_result.passed();
+                continue;
+            }
+            GalaxyBenchmark benchmark(galaxy, min_time_ms);
+
+            print_result(name, n_players, "distance_to_other_tiles",
+                    benchmark.distance_to_other_tiles(), 0);
+            print_result(name, n_players, "get_adjacent",
+                    benchmark.get_adjacent(), 0);
+            print_result(name, n_players, "calculate_stakes",
+                    benchmark.calculate_stakes(), 0);
+            print_result(name, n_players, "calculate_shares",
+                    benchmark.calculate_shares(), 0);
+            print_result(name, n_players, "evaluate_grid",
+                    benchmark.evaluate_grid(), 1);
+
+            long n_evaluations = 0;
+            auto optimize_result = benchmark.optimize_grid(optimizer_options,
+                    n_evaluations);
+            print_result(name, n_players, "optimize_grid", optimize_result,
+                    n_evaluations);
+        }
+    }
+    return passed ? 0 : 1;
+}
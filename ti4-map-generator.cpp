@@ -1,1451 +1,770 @@
 #include <iostream>
-#include <fstream>
-#include <list>
-#include <set>
-#include <map>
-#include <queue>
-#include <vector>
-#include <algorithm>
-#include <cstdlib>
-#include <time.h>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <cstring>
 #include <exception>
-#include <cmath>
-#include <iterator>
-#include <sstream>
+#include <deque>
+#include <condition_variable>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
-#include "json.hpp"
 #include "cxxopts.hpp"
 
 #define BACKWARD_HAS_BFD 1
 #include "backward-cpp/backward.hpp"
 
-#define MIN(a,b) (((a)<(b))?(a):(b))
-#define MAX(a,b) (((a)>(b))?(a):(b))
+#include "galaxy.hpp"
+#include "result_cache.hpp"
+#include "tile_database.hpp"
 
-using json = nlohmann::json;
-using namespace std;
-
-enum PlanetTrait
-{
-    NO_TRAIT,
-    CULTURAL,
-    INDUSTRIAL,
-    HAZARDOUS
-};
-
-static map<string, PlanetTrait> trait_key = {
-    {"NO_TRAIT", NO_TRAIT},
-    {"CULTURAL", CULTURAL},
-    {"HAZARDOUS", HAZARDOUS},
-    {"INDUSTRIAL", INDUSTRIAL}
-};
-
-enum TechColor
-{
-    NO_TECH,
-    BLUE,
-    RED,
-    GREEN,
-    YELLOW
-};
-
-static map<string, TechColor> tech_key = {
-    {"NO_TECH", NO_TECH},
-    {"BLUE", BLUE},
-    {"RED", RED},
-    {"GREEN", GREEN},
-    {"YELLOW", YELLOW}
-};
-
-enum Wormhole
-{
-    NO_WORMHOLE,
-    ALPHA,
-    BETA,
-    DELTA
-};
-
-static map<string, Wormhole> wormhole_key = {
-    {"NO_WORMHOLE", NO_WORMHOLE},
-    {"ALPHA", ALPHA},
-    {"BETA", BETA},
-    {"DELTA", DELTA}
-};
-
-enum Anomaly
-{
-    NO_ANOMALY,
-    EMPTY,
-    GRAVITY_RIFT,
-    NEBULA,
-    SUPERNOVA,
-    ASTEROID_FIELD
-};
-
-static map<string, Anomaly> anomaly_key = {
-    {"NO_ANOMALY", NO_ANOMALY},
-    {"EMPTY", EMPTY},
-    {"GRAVITY_RIFT", GRAVITY_RIFT},
-    {"NEBULA", NEBULA},
-    {"SUPERNOVA", SUPERNOVA},
-    {"ASTEROID_FIELD", ASTEROID_FIELD},
-};
-
-typedef struct Planet
-{
-    string name;
-    int resources;
-    int influence;
-    PlanetTrait trait;
-    TechColor tech;
-} Planet;
-
-typedef struct Location
-{
-    int i;
-    int j;
-
-    Location operator+(Location a) {
-        struct Location new_location;
-        new_location.i = this->i + a.i;
-        new_location.j = this->j + a.j;
-        return new_location;
-    }
-    bool operator==(Location a) {
-        return i == a.i && j == a.j;
-    }
-} Location;
-
-
-
-class Tile
-{
-    int number;
-    Wormhole wormhole;
-    list<Planet> planets;
-    Anomaly anomaly;
-    Location location;
-    string race;
-
-    int resources = 0;
-    int influence = 0;
-    float res_inf = 0;
-
-    public:
-    Tile(int);
-    Tile(int, string);
-    Tile(int, list<Planet>, Wormhole, Anomaly);
-    Tile(int, list<Planet>, string race);
-    string get_description_string() const;
-    int get_number();
-    Wormhole get_wormhole();
-    Anomaly get_anomaly();
-    TechColor get_techcolor();
-    void set_location(Location);
-    Location get_location();
-    int get_resource_value();
-    int get_influence_value();
-    float get_res_inf_value();
-    list<Planet> get_planets();
-    string get_race();
-    bool is_home_system();
-};
-
-list<Planet> Tile::get_planets()
+cxxopts::Options make_options()
 {
-    return planets;
-}
-
-
-string Tile::get_race()
-{
-    return race;
-}
-
-int Tile::get_resource_value()
-{
-    return resources;
-}
-
-int Tile::get_influence_value()
-{
-    return influence;
-}
-
-float Tile::get_res_inf_value()
-{
-    return res_inf;
-}
-
-int Tile::get_number() {
-    return number;
-}
-
-Anomaly Tile::get_anomaly() {
-    return anomaly;
-}
-
-TechColor Tile::get_techcolor() {
-   for (auto p : planets) {
-       if (p.tech) {
-           return p.tech;
-       }
-   }
-   return NO_TECH;
-}
-
-Wormhole Tile::get_wormhole() {
-    return wormhole;
-}
-
-void Tile::set_location(Location l) {
-    location = l;
-}
-
-Location Tile::get_location() {
-    return location;
-}
-
-string Tile::get_description_string() const {
-    ostringstream desc;
-    desc << "Tile " << number << " - ";
-    for (auto it = planets.begin(); it != planets.end(); it++) {
-        if (it != planets.begin()) {
-            desc << ", ";
-        }
-        desc << it->name;
-    }
-
-    return desc.str();
-}
-
-bool Tile::is_home_system()
-{
-    return race.length();
-}
-
-std::ostream& operator<< (std::ostream &out, Tile const& tile) {
-    out << tile.get_description_string();
-    return out;
+    cxxopts::Options options("ti4-map-generator", "Generate balanced TI4 maps");
+    options.add_options()
+            ("h,help", "Print help")
+            ("serve", "run as a daemon answering json generation requests on this unix socket", cxxopts::value<std::string>())
+            ("batch", "generate a galaxy for each json request in this jsonl file, writing one json result per line to stdout", cxxopts::value<std::string>())
+            ("layouts", "directory of layouts loaded by --serve, --batch and --compile_db", cxxopts::value<std::string>()->default_value("../res/layouts"))
+            ("cache", "directory to keep results in, so that repeated requests are not generated again", cxxopts::value<std::string>())
+            ("cache_size_mb", "size the cache is kept under by removing the least recently used results", cxxopts::value<int>()->default_value("256"))
+            ("db", "compiled tile and layout database to load from instead of the json files, where it is up to date", cxxopts::value<std::string>())
+            ("compile_db", "compile the tile file and every layout in --layouts into this database and exit", cxxopts::value<std::string>())
+            ("t,tiles", "json file defining tile properites", cxxopts::value<std::string>())
+            ("l,layout", "json file defining galaxy shape", cxxopts::value<std::string>())
+            ("o,output", "galaxy json output filename", cxxopts::value<std::string>())
+            ("p,players", "number of players", cxxopts::value<int>()->default_value("6"))
+            ("s,seed", "random seed", cxxopts::value<int>())
+            ("restarts", "number of independently generated starting galaxies to optimize, the best is kept", cxxopts::value<int>()->default_value("1"))
+            ("threads", "number of threads to optimize restarts on, or to run --batch requests or --serve connections on (0 to use every core)", cxxopts::value<int>()->default_value("1"))
+            ("optimizer", "search strategy: hill_climb, anneal, steepest_descent, tabu, parallel_tempering or genetic", cxxopts::value<string>()->default_value("hill_climb"))
+            ("time_limit_ms", "stop optimizing each restart after this many milliseconds (0 for no limit)", cxxopts::value<int>()->default_value("0"))
+            ("max_evaluations", "stop optimizing each restart after scoring this many grids (0 for no limit, anneal and tabu default to 100000, parallel_tempering and genetic to 100000 per replica or island)", cxxopts::value<long>()->default_value("0"))
+            ("trace", "record the score after every move the optimizer makes into this file, as csv if it ends in .csv and binary otherwise", cxxopts::value<std::string>())
+            ("trace_size", "number of moves --trace keeps, beyond which the oldest are dropped", cxxopts::value<long>()->default_value("262144"))
+            ("stats", "time each phase of the generation and count swaps and evaluations, written as json beside the output file (or added to --serve and --batch responses)")
+            ("deadline_ms", "stop all optimization this many milliseconds after starting and write the best galaxy found so far (0 for no deadline)", cxxopts::value<int>()->default_value("0"))
+            ("moves", "comma separated kinds of move the optimizer tries: swap, cycle (three tiles round), ring_rotation (a ring round mecatol by one) and slice_swap (two home systems' slices)", cxxopts::value<string>()->default_value("swap"))
+            ("anneal_schedule", "temperature schedule for anneal: geometric or linear", cxxopts::value<string>()->default_value("geometric"))
+            ("start_temperature", "starting temperature for anneal, and temperature of the hottest parallel_tempering replica", cxxopts::value<float>()->default_value("0.05"))
+            ("end_temperature", "final temperature for anneal, and temperature of the coldest parallel_tempering replica", cxxopts::value<float>()->default_value("0.0005"))
+            ("replicas", "number of annealing chains parallel_tempering runs side by side", cxxopts::value<int>()->default_value("8"))
+            ("exchange_interval", "annealing steps each parallel_tempering replica makes between exchanges", cxxopts::value<long>()->default_value("200"))
+            ("islands", "number of populations the genetic optimizer evolves side by side", cxxopts::value<int>()->default_value("4"))
+            ("population", "number of galaxies on each genetic island", cxxopts::value<int>()->default_value("16"))
+            ("migration_interval", "generations between each genetic island sending its best galaxy to the next", cxxopts::value<int>()->default_value("10"))
+            ("mutation_swaps", "random swaps tried on each child of the genetic optimizer, kept unless they make it worse", cxxopts::value<int>()->default_value("10"))
+            ("tabu_tenure", "number of moves for which tabu search will not swap back the tiles it just swapped", cxxopts::value<int>()->default_value("30"))
+            ("exact", "after optimizing, search every placement of the movable systems by branch and bound until the galaxy is proven optimal or a limit is reached (100000 nodes if none is given)")
+            ("star_by_star", "allow free placement of home systems")
+            ("dummy_homes", "use blank home systems (default)")
+            ("random_homes", "use random race home systems")
+            ("choose_homes", "use with --races option")
+            ("pie_slice_assignment", "Assign systems <= 2 spaces away from a home systems entirely to the(those) home systems <=2 away")
+            ("r,races", "list of home system tile numbers like so \"1 2 5...\"", cxxopts::value<string>()->default_value("6"))
+            ("mandatory_tiles", "List of mandatory tiles to include", cxxopts::value<string>())
+            ("creuss_gets_wormhole", "If creuss in game place a wormhole within x distance of it", cxxopts::value<int>()->default_value("1"))
+            ("muaat_gets_supernova", "If muaat in game place the supernova within x distance of it", cxxopts::value<int>()->default_value("1"))
+            ("winnu_have_clear_path_to_mecatol", "If winnu in game give them a clear path to mecatol", cxxopts::value<int>()->default_value("1"))
+            ("saar_get_asteroids", "If Saar are in the game give them an asteroid field", cxxopts::value<int>()->default_value("1"))
+            ("resource_weight", "Relative weight of resource variance", cxxopts::value<float>()->default_value("1.0"))
+            ("influence_weight", "Relative weight of infuence variance", cxxopts::value<float>()->default_value("1.0"))
+            ("res_inf_weight", "Relative weight of max(res,2/3inf)", cxxopts::value<float>()->default_value("1.0"))
+            ("trait_weight", "Relative weight of planet trait variance", cxxopts::value<float>()->default_value("0.3"))
+            ("tech_weight", "Relative weight of tech specialty variance", cxxopts::value<float>()->default_value("1.0"))
+            ("first_turn", "Relative weight of first turn res+2/3inf", cxxopts::value<float>()->default_value("1.0"))
+            ("ring_balance_weight", "Relative weight of ring balancing", cxxopts::value<float>()->default_value("1.0"))
+            ("ring_balance", "Put higher value systems closer/farther balanced from mecatol", cxxopts::value<float>())
+            ("res_value_of_inf", "Relative weight of ring balancing", cxxopts::value<float>()->default_value("0.667"))
+            ;
+    return options;
 }
 
-Tile::Tile(int n) : number(n), wormhole(NO_WORMHOLE), anomaly(NO_ANOMALY), race("") {};
-
-Tile::Tile(int n, string race) 
-    : number(n), wormhole(NO_WORMHOLE), anomaly(NO_ANOMALY), race(race) {};
-
-Tile::Tile(int n, list<Planet> p, Wormhole w, Anomaly a)
+/* Reads the evaluate options once, so every galaxy of a request shares one
+ * checked config. Throws invalid_argument for values out of range
+ */
+EvaluationConfig make_evaluation_config(cxxopts::ParseResult& result)
 {
-    number = n;
-    planets = p;
-    wormhole = w;
-    anomaly = a;
-    race = "";
-
-    resources = 0;
-    influence = 0;
-    res_inf = 0;
-    for (auto planet : planets) {
-        resources += planet.resources;
-        influence += planet.influence;
-        res_inf += max(1.0 * planet.resources, planet.influence * 0.667);
+    EvaluationConfig config;
+    for (auto& key : evaluation_distance_key) {
+        config.set(key.first, result[key.first].as<int>());
     }
-}
-
-Tile::Tile(int n, list<Planet> p, string race1)
-{
-    number = n;
-    planets = p;
-    wormhole = NO_WORMHOLE;
-    anomaly = NO_ANOMALY;
-    race = race1;
-
-    resources = 0;
-    influence = 0;
-    res_inf = 0;
-    for (auto planet : planets) {
-        resources += planet.resources;
-        influence += planet.influence;
-        res_inf += max(1.0 * planet.resources, planet.influence * 0.667);
+    for (auto& key : evaluation_weight_key) {
+        config.set(key.first, result[key.first].as<float>());
     }
-}
-
-typedef map<Tile*,map<Tile*, float>> double_tile_map;
-
-enum HomeSystemSetups {DUMMY, RANDOM_RACES, CHOSEN_RACES};
-
-struct layout_info
-{
-    int n_blue;
-    int n_red;
-    list<Location> start_positions;
-};
-
-typedef struct Scores
-{
-    map<Tile*, float> resource_share;
-    map<Tile*, float> influence_share;
-    map<Tile*, float> res_inf_share;
-    map<Tile*, float> tech_share;
-    map<Tile*, float> first_turn_share;
-
-    map<string, float> penalties;
-} Scores;
-
-class Galaxy
-{
-    list<Tile> tiles;
-    vector<vector<Tile*>> grid; // Locations of tiles
-    Tile *mecatol;
-    list<Tile*> home_systems;
-    list<Tile*> movable_systems;
-    list<Tile*> placed_tiles;
-    list<Tile*> red_tiles;
-    list<Tile*> blue_tiles;
-    map<Wormhole, list<Tile*>> wormhole_systems;
-    Tile boundary_tile; // used for inaccesable locations in the grid
-    map<string, float> evaluate_options;
-    list<vector<Location>> warp_connections;
-    Scores scores;
-    double_tile_map stakes;
-
-    void import_tiles(string tile_filename);
-    struct layout_info import_layout(string layout_filename, int n_players);
-    void random_home_tiles(int n);
-    void dummy_home_tiles(int n);
-    void chosen_home_tiles(string chosen);
-    void initialize_grid(struct layout_info layout_info, string mandatory_tile_numbers, bool star_by_star);
-    void place_tile(Location location, Tile*);
-    void swap_tiles(Tile *, Tile *);
-    int count_home_systems_without_planets();
-    int count_adjacent_anomalies();
-    int count_adjacent_home_systems();
-    int count_adjacent_wormholes();
-    Tile* get_tile_at(Location location);
-    Tile* get_tile_by_number(int n);
-    list<Tile*> get_adjacent(Tile* t1, bool go_through_wormholes = true);
-    map<Tile*, float> distance_to_other_tiles(Tile* t1);
-    double_tile_map calculate_stakes(double_tile_map distances);
-    Scores calculate_shares(double_tile_map stakes);
-    float apply_penalties(double_tile_map distances);
-    float calculate_trait_variance(double_tile_map stakes);
-    float first_turn_variance(double_tile_map stakes, Scores& scores);
-    float calculate_ring_balance(map<Tile*, float>);
-    vector<pair<Tile*, Tile*>> make_swap_list();
-    bool is_wormhole_near_creuss(int near_dist, double_tile_map distances);
-    bool is_supernova_near_muaat(int near_dist, double_tile_map distances);
-    bool is_asteroid_near_saar(int near_dist, double_tile_map distances);
-    bool winnu_have_clear_path_to_mecatol(double_tile_map distances);
-
-
-    public:
-    Galaxy(string tile_filename, string layout_filename, int n_players, 
-            HomeSystemSetups, string home_tile_ids, 
-            string mandatory_tile_numbers, bool star_by_star);
-    void print_grid();
-    void print_distances_from(int);
-    void set_evaluate_option(string name, float val);
-    float evaluate_grid();
-    void optimize_grid();
-    void write_json(string filename);
-};
-
-Galaxy::Galaxy(string tile_filename, string layout_filename, int n_players, 
-        HomeSystemSetups hss, string home_tile_numbers, 
-        string mandatory_tile_numbers, bool star_by_star)
-    : boundary_tile(0)
-{
-    import_tiles(tile_filename);
-    auto info = import_layout(layout_filename, n_players);
-    switch (hss) {
-        case DUMMY: 
-            dummy_home_tiles(n_players);
-            break;
-        case RANDOM_RACES:
-            random_home_tiles(n_players);
-            break;
-        case CHOSEN_RACES:
-            chosen_home_tiles(home_tile_numbers);
-    }
-    initialize_grid(info, mandatory_tile_numbers, star_by_star);
-
-    //for (auto i : tiles) {
-    //    cout << i << endl;
-    //}
-}
-
-void Galaxy::place_tile(Location l, Tile* tile) 
-{
-    if (tile) {
-        tile->set_location(l);
+    if (result.count("ring_balance")) {
+        config.set("ring_balance", result["ring_balance"].as<float>());
     }
-    grid[l.i][l.j] = tile;
+    config.pie_slice_assignment = result.count("pie_slice_assignment") > 0;
+    config.validate();
+    return config;
 }
 
-Planet create_planet_from_json(json j)
-{
-    Planet new_planet;
-
-    new_planet.name = j["name"];
-    new_planet.resources = j["resources"];
-    new_planet.influence = j["influence"];
-
-    new_planet.trait = trait_key.at(j["trait"]);
-    new_planet.tech = tech_key.at(j["tech"]);
-
-    return new_planet;
-}
-
-Tile create_tile_from_json(json j)
-{
-    int number = j["number"];
-    Wormhole wormhole = wormhole_key.at(j["wormhole"]);
-    Anomaly anomaly = anomaly_key.at(j["anomaly"]);
+/* Optimizes n_restarts independently generated galaxies spread over n_threads
+ * threads and returns the one with the best score. Ties go to the earliest
+ * restart so that the result does not depend on the number of threads.
+ * Restarts that have not begun by the deadline are skipped, except the first,
+ * so there is always a galaxy to return. If any restart was cut off or 
+ * skipped the returned galaxy is marked as stopped by the deadline. If a
+ * restart throws, the restarts left are skipped and the first exception is
+ * rethrown once every thread has finished
+ */
+Galaxy* optimize_restarts(function<Galaxy*(int)> make_galaxy, 
+        const OptimizerOptions& optimizer_options, int n_restarts, int n_threads)
+{
+    vector<unique_ptr<Galaxy>> galaxies(n_restarts);
+    vector<float> scores(n_restarts, INFINITY);
+    atomic<int> next_restart(0);
+    exception_ptr error;
+    mutex error_mutex;
+
+    auto run_restarts = [&]() {
+        for (int restart = next_restart++; restart < n_restarts; 
+                restart = next_restart++) {
+            if (restart and chrono::steady_clock::now() >= optimizer_options.deadline) {
+                continue;
+            }
+            try {
+                galaxies[restart].reset(make_galaxy(restart));
+                galaxies[restart]->optimize_grid(optimizer_options);
+                scores[restart] = galaxies[restart]->evaluate_grid();
+            } catch (...) {
+                lock_guard<mutex> lock(error_mutex);
+                if (not error) {
+                    error = current_exception();
+                }
+                next_restart = n_restarts;
+            }
+        }
+    };
 
-    // Create planet list
-    json planet_list = j["planets"];
-    list<Planet> planets;
-    for (json::iterator it = planet_list.begin(); it != planet_list.end(); it++) {
-        planets.push_back(create_planet_from_json(it.value()));
+    vector<thread> threads;
+    for (int i = 1; i < MIN(n_threads, n_restarts); i++) {
+        threads.push_back(thread(run_restarts));
     }
-
-    if (j.find("race") != j.end()) {
-        string race = j["race"];
-        return Tile(number, planets, race);
-    } else {
-        return Tile(number, planets, wormhole, anomaly);
+    run_restarts();
+    for (auto& t : threads) {
+        t.join();
     }
-}
-
-void Galaxy::import_tiles(string tile_filename)
-{
-    // Parse tile json
-    json tile_json;
-    ifstream json_file;
-    cerr << "Importing tiles from " << tile_filename << endl;
-    json_file.open(tile_filename);
-    try {json_file >> tile_json;} 
-    catch (...) {
-        cerr << "Error loading/parsing " << tile_filename << endl;
-        exit(-1);
+    if (error) {
+        rethrow_exception(error);
     }
-    json_file.close();
 
-    // Create list of tiles
-    json tile_list = tile_json["red_tiles"];
-    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
-        tiles.push_back(create_tile_from_json(it.value()));
-        Tile *added_tile = &tiles.back();
-        red_tiles.push_back(added_tile);
-        if (added_tile->get_wormhole()) {
-            wormhole_systems[added_tile->get_wormhole()].push_back(added_tile);
+    int best = 0;
+    bool cut_off = false;
+    for (int restart = 0; restart < n_restarts; restart++) {
+        if (not galaxies[restart] 
+                or galaxies[restart]->get_stop_reason() == DEADLINE) {
+            cut_off = true;
         }
-    }
-    tile_list = tile_json["blue_tiles"];
-    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
-        tiles.push_back(create_tile_from_json(it.value()));
-        Tile *added_tile = &tiles.back();
-        blue_tiles.push_back(added_tile);
-        if (added_tile->get_wormhole()) {
-            wormhole_systems[added_tile->get_wormhole()].push_back(added_tile);
+        if (scores[restart] < scores[best]) {
+            best = restart;
         }
     }
-    // Also home tiles
-    tile_list = tile_json["home_tiles"];
-    for (json::iterator it = tile_list.begin(); it != tile_list.end(); it++) {
-        tiles.push_back(create_tile_from_json(it.value()));
-        Tile *added_tile = &tiles.back();
-        home_systems.push_back(added_tile);
-    }
-    
-    // Save a pointer to mecatol rex
-    tiles.push_back(create_tile_from_json(tile_json["mecatol"]));
-    mecatol = &tiles.back();
-
-    cerr << "Loaded " << tiles.size() << " tiles" << endl;
-    cerr << "\tblue: " << blue_tiles.size() << " " << endl;
-    cerr << "\tred:" << red_tiles.size() << " tiles" << endl;
-}
-
-list<Tile*> get_tile_pointers(list<Tile*> tiles, string numbers)
-{
-    list<int> n_list;
-    stringstream chosen_ss(numbers);
-    int n;
-    while (chosen_ss >> n) {
-        cout << "using number " << n << endl;
-        n_list.push_back(n);
-    }
-    
-    list<Tile*> matching_tiles;
-    for (auto t : tiles) {
-        if (find(n_list.begin(), n_list.end(), t->get_number()) != n_list.end()) {
-            matching_tiles.push_back(t);
-        }
+    if (cut_off) {
+        galaxies[best]->set_stop_reason(DEADLINE);
     }
 
-    return matching_tiles;
-}
-
-Tile * Galaxy::get_tile_by_number(int n) {
-    for (auto it = tiles.begin(); it != tiles.end(); it++) {
-        if (it->get_number() == n) {
-            return &*it;
+    // Report the work of every restart, not just the one kept
+    GeneratorStats total;
+    total.timed = galaxies[best]->get_stats().timed;
+    for (auto& galaxy : galaxies) {
+        if (galaxy) {
+            total.add(galaxy->get_stats());
         }
     }
-    throw domain_error("No tile with requested number found");
+    galaxies[best]->get_stats() = total;
+    return galaxies[best].release();
 }
 
-
-struct layout_info Galaxy::import_layout(string layout_filename, int n_players)
+/* Generates the galaxy described by the command line options in result from
+ * tiles and a layout that have already been loaded. Throws invalid_argument
+ * if the options do not describe a galaxy that can be generated. Every move
+ * the optimizer makes is recorded in trace, unless it is NULL
+ */
+Galaxy* generate_galaxy(cxxopts::ParseResult& result, const TileSet& tile_set,
+        const Layout& layout, unsigned int seed, 
+        chrono::steady_clock::time_point start_time, bool verbose,
+        ConvergenceTrace* trace)
 {
-    json layout_json;
-    ifstream json_file;
-    cerr << "Importing layout from " << layout_filename << endl;
-    json_file.open(layout_filename);
-    try {json_file >> layout_json;} 
-    catch (...) {
-        cerr << "Error loading/parsing " << layout_filename << endl;
-        exit(-1);
-    }
-    json_file.close();
-
-    list<Location> valid_locations;
-    int max_i = 0;
-    int max_j = 0;
-    for (auto l : layout_json["valid_locations"]) {
-        int i = l.at(0);
-        int j = l.at(1);
-        max_i = i > max_i ? (int) i : max_i;
-        max_j = j > max_j ? (int) j : max_j;
-        valid_locations.push_back({i, j});
+    int n_restarts = MAX(result["restarts"].as<int>(), 1);
+    int n_threads = result["threads"].as<int>();
+    if (n_threads <= 0) {
+        n_threads = MAX((int) thread::hardware_concurrency(), 1);
     }
 
-    grid.resize(max_i+1, vector<Tile*>(max_j+1));
-    for (int i = 0; i <= max_i; i++) {
-        for (int j = 0; j <= max_j; j++) {
-            place_tile({i, j}, &boundary_tile);
-        }
-    }
+    HomeSystemSetups hss = DUMMY;
+    string races;
 
-    for (auto l : valid_locations) {
-        place_tile(l, NULL);
+    if (result.count("random_homes")) {
+        hss = RANDOM_RACES;
     }
-
-    for (json::iterator it = layout_json["fixed_tiles"].begin(); it != layout_json["fixed_tiles"].end(); ++it) {
-        Tile* t = get_tile_by_number(stoi(it.key()));
-        int i = it.value().at(0);
-        int j = it.value().at(1);
-        place_tile({i, j}, t);
-        red_tiles.remove(t);
-        blue_tiles.remove(t);
-        placed_tiles.push_back(t);
+    if (result.count("choose_homes")) {
+        hss = CHOSEN_RACES;
+        if (not result.count("races")) {
+            throw invalid_argument("Must also provide list of races with -r option");
+        }
+        races = result["races"].as<string>();
     }
 
-    struct layout_info info;
-    for (auto l : layout_json["home_tile_positions"][to_string(n_players)]) {
-        int i = l.at(0);
-        int j = l.at(1);
-        info.start_positions.push_back({i, j});
+    string mandatory_tiles = "";
+    if (result.count("mandatory_tiles")) {
+        mandatory_tiles = result["mandatory_tiles"].as<string>();
     }
 
-    if (layout_json.find("warp_connections") != layout_json.end()) {
-        for (auto & j_connection : layout_json["warp_connections"]) {
-            vector<Location> warp_connection(2);
-            warp_connection[0].i = j_connection[0][0];
-            warp_connection[0].j = j_connection[0][1];
-            warp_connection[1].i = j_connection[1][0];
-            warp_connection[1].j = j_connection[1][1];
-            warp_connections.push_back(warp_connection);
-        }
-    }
+    OptimizerOptions optimizer_options;
+    try {
+        optimizer_options.strategy = optimizer_key.at(result["optimizer"].as<string>());
+        optimizer_options.schedule = schedule_key.at(result["anneal_schedule"].as<string>());
+    } catch (const out_of_range&) {
+        throw invalid_argument("Unknown optimizer or anneal schedule");
+    }
+    optimizer_options.moves = parse_move_types(result["moves"].as<string>());
+    optimizer_options.time_limit_ms = result["time_limit_ms"].as<int>();
+    optimizer_options.max_evaluations = result["max_evaluations"].as<long>();
+    optimizer_options.start_temperature = result["start_temperature"].as<float>();
+    optimizer_options.end_temperature = result["end_temperature"].as<float>();
+    if (not (optimizer_options.end_temperature > 0 
+                and optimizer_options.end_temperature <= optimizer_options.start_temperature)) {
+        throw invalid_argument("temperatures must satisfy "
+                "0 < end_temperature <= start_temperature");
+    }
+    optimizer_options.tabu_tenure = result["tabu_tenure"].as<int>();
+    if (optimizer_options.tabu_tenure < 0) {
+        throw invalid_argument("tabu_tenure cannot be negative");
+    }
+    optimizer_options.n_replicas = result["replicas"].as<int>();
+    optimizer_options.exchange_interval = result["exchange_interval"].as<long>();
+    if (optimizer_options.n_replicas < 2 or optimizer_options.exchange_interval < 1) {
+        throw invalid_argument("parallel_tempering needs at least 2 replicas "
+                "and an exchange_interval of at least 1");
+    }
+    optimizer_options.exact = result.count("exact") > 0;
+    optimizer_options.n_islands = result["islands"].as<int>();
+    optimizer_options.population = result["population"].as<int>();
+    optimizer_options.migration_interval = result["migration_interval"].as<int>();
+    optimizer_options.mutation_swaps = result["mutation_swaps"].as<int>();
+    if (optimizer_options.n_islands < 1 or optimizer_options.population < 2
+            or optimizer_options.migration_interval < 1 
+            or optimizer_options.mutation_swaps < 0) {
+        throw invalid_argument("genetic needs at least 1 island of 2 galaxies, "
+                "a migration_interval of at least 1 and no negative mutation_swaps");
+    }
+    if (result["deadline_ms"].as<int>() > 0) {
+        optimizer_options.deadline = start_time 
+            + chrono::milliseconds(result["deadline_ms"].as<int>());
+    }
+    // Threads not needed to run restarts side by side go to each optimization
+    optimizer_options.n_threads = MAX(n_threads / MIN(n_threads, n_restarts), 1);
+    optimizer_options.verbose = verbose;
+    optimizer_options.trace = trace;
+
+    EvaluationConfig evaluation_config = make_evaluation_config(result);
+
+    auto make_galaxy = [&](int restart) {
+        Galaxy* galaxy = new Galaxy(tile_set, layout, result["players"].as<int>(), 
+                hss, races, mandatory_tiles, 
+                result.count("star_by_star") ? true : false, seed, restart);
+        galaxy->set_evaluation_config(evaluation_config);
+        galaxy->get_stats().timed = result.count("stats") > 0;
+        return galaxy;
+    };
 
-    info.n_blue = layout_json["movable_tile_counts"][to_string(n_players)]["blue"];
-    info.n_red = layout_json["movable_tile_counts"][to_string(n_players)]["red"];
-    return info;
+    return optimize_restarts(make_galaxy, optimizer_options, n_restarts, n_threads);
 }
 
-list<Tile*> get_shuffled_list(list<Tile*> l)
+unsigned int get_seed(cxxopts::ParseResult& result)
 {
-    vector<Tile *> to_shuffle;
-    list<Tile *> ret;
-    for (auto it : l) {
-        to_shuffle.push_back(it);
-    }
-    random_shuffle(to_shuffle.begin(), to_shuffle.end());
-    for (auto it : to_shuffle) {
-        ret.push_back(it);
-    }
-    return ret;
-}
-
-void Galaxy::random_home_tiles(int n) {
-    auto shuffled = get_shuffled_list(home_systems);
-    auto it = shuffled.begin();
-    home_systems.clear();
-    list<Tile*> new_home_tiles;
-    for (int i = 0; i < n; i++) {
-        home_systems.push_back(*it);
-        it++;
+    if (not result.count("seed")) {
+        return time(NULL);
     }
+    return result["seed"].as<int>();
 }
 
-void Galaxy::chosen_home_tiles(string chosen) {
+// Options that configure the generator process rather than a galaxy, so they
+// cannot be given in a request
+static set<string> process_options = {"help", "tiles", "output", "serve", "batch", 
+    "layouts", "cache", "cache_size_mb", "db", "compile_db", "trace", "trace_size"};
 
-    list<Tile*> available_home_systems;
-    available_home_systems = get_tile_pointers(home_systems, chosen);
-    home_systems = available_home_systems;
-}
+// Bump whenever a change to the generator changes the galaxy a request 
+// produces, so that results cached by older versions are not reused
+#define GENERATOR_VERSION 4
 
-void Galaxy::dummy_home_tiles(int n) {
-    home_systems.clear();
-    for (int i = 0; i < n; i++) {
-        Tile new_tile = Tile(-i - 1, "Home System " + to_string(i + 1));
-        tiles.push_back(new_tile);
-        home_systems.push_back(&tiles.back());
+/* Key of the cache entry for a request: a digest of everything that decides
+ * which galaxy it generates, with defaults filled in. Options that only 
+ * change how fast it is found, like threads, are left out. Empty if the 
+ * galaxy does not only depend on the request, because there is no seed, 
+ * there is a time limit or genetic islands or --exact run on several threads
+ */
+string cache_key(cxxopts::ParseResult& result, const TileSet& tile_set, 
+        const Layout& layout)
+{
+    if (not result.count("seed") or result["time_limit_ms"].as<int>()) {
+        return "";
     }
-}
-
-template <class t>
-list<t> get_shuffled_list(list<t> l) {
-    list<t> new_list;
-    new_list = l;
-    random_shuffle(l.begin(), l.end());
-    return l;
-}
-
-void Galaxy::initialize_grid(struct layout_info layout_info, string mandatory_tile_numbers, bool star_by_star) {
-
-    // Place home systems (Star by star means that home systems can be anywhere)
-    if (not star_by_star) {
-        auto sp_it = layout_info.start_positions.begin();
-        for (auto hs : get_shuffled_list(home_systems)) {
-            place_tile(*sp_it, hs);
-            sp_it++;
-            placed_tiles.push_back(hs);
-        }
+    if ((result["optimizer"].as<string>() == "genetic" or result.count("exact"))
+            and result["threads"].as<int>() != 1) {
+        return "";
     }
 
-    // Collect tiles to randomly place later as the inital galaxy setup, starting 
-    // with mandatory tiles
-    list<Tile*> random_tiles;
-    list<Tile*> tmp;
-    tmp = get_tile_pointers(blue_tiles, mandatory_tile_numbers);
-    layout_info.n_blue -= tmp.size();
-    random_tiles = tmp;
-
-    tmp = get_tile_pointers(red_tiles, mandatory_tile_numbers);
-    layout_info.n_red -= tmp.size();
-    random_tiles.insert(random_tiles.end(), tmp.begin(), tmp.end());
-
-    // Also home systems if playing star by star
-    if (star_by_star) {
-        random_tiles.insert(random_tiles.end(), home_systems.begin(), home_systems.end());
+    json canonical;
+    canonical["version"] = GENERATOR_VERSION;
+    canonical["tiles"] = tile_set.digest;
+    canonical["layout"] = layout.digest;
+    for (auto name : {"players", "seed", "restarts", "tabu_tenure", "replicas",
+            "islands", "population", "migration_interval", "mutation_swaps"}) {
+        canonical[name] = result[name].as<int>();
     }
-
-    // Then just get the rest of the needed tiles
-    for (auto s : get_shuffled_list(blue_tiles)) {
-        if (find(random_tiles.begin(), random_tiles.end(), s) == random_tiles.end()) {
-            random_tiles.push_back(s);
-            layout_info.n_blue--;
-            if (not layout_info.n_blue) {
-                break;
-            }
-        }
+    for (auto name : {"max_evaluations", "exchange_interval"}) {
+        canonical[name] = result[name].as<long>();
     }
-
-    for (auto s : get_shuffled_list(red_tiles)) {
-        if (find(random_tiles.begin(), random_tiles.end(), s) == random_tiles.end()) {
-            random_tiles.push_back(s);
-            layout_info.n_red--;
-            if (not layout_info.n_red) {
-                break;
-            }
-        }
+    for (auto name : {"start_temperature", "end_temperature"}) {
+        canonical[name] = result[name].as<float>();
     }
-
-    // Shuffle the tiles to be placed and place them in the grid
-    // Any tiles placed this way are also movable tiles
-    random_tiles = get_shuffled_list(random_tiles);
-    movable_systems.clear();
-    for (int i = 0; i < (int) grid.size(); i++) {
-        for (int j = 0; j < (int) grid[i].size(); j++) {
-            if (not grid[i][j]) {
-                place_tile({i, j}, random_tiles.front());
-                movable_systems.push_back(random_tiles.front());
-                random_tiles.pop_front();
-            }
-        }
+    canonical["evaluation"] = make_evaluation_config(result).to_json();
+    for (auto name : {"optimizer", "anneal_schedule", "moves"}) {
+        canonical[name] = result[name].as<string>();
     }
-
-    placed_tiles.insert(placed_tiles.begin(), 
-            movable_systems.begin(), movable_systems.end());
-}
-
-
-void Galaxy::print_grid() {
-    for (int i = 0; i < (int) grid.size(); i++) {
-        for (int i_pad = 0; i_pad < (int) grid.size() - i; i_pad++) {
-            cout << "  ";
-        }
-        for (int j = 0; j < (int) grid[i].size(); j++) {
-            if (grid[i][j] and grid[i][j] != &boundary_tile) {
-                printf(" %02d ", grid[i][j]->get_number());
-            } else {
-                cout << "    ";
-            }
-        }
-        cout << endl << endl;
+    for (auto name : {"star_by_star", "random_homes", "choose_homes", "exact"}) {
+        canonical[name] = result.count(name) > 0;
     }
-}
-
-Tile* Galaxy::get_tile_at(Location l) {
-    if (l.i < 0 or l.i >= (int) grid.size() 
-            or l.j < 0 or l.j >= (int) grid[l.i].size()) {
-        return NULL;
+    if (result.count("choose_homes")) {
+        canonical["races"] = result["races"].as<string>();
     }
-    Tile * tile = grid[l.i][l.j];
-    if (tile == &boundary_tile) {
-        return NULL;
+    if (result.count("mandatory_tiles")) {
+        canonical["mandatory_tiles"] = result["mandatory_tiles"].as<string>();
     }
-    return tile;
+    return content_digest(canonical.dump());
 }
 
-list<Tile*> Galaxy::get_adjacent(Tile *t1, bool go_through_wormholes)
-{
-    list<Location> directions = {
-        {0,1}, {1,1}, {1, 0}, {0, -1}, {-1, -1}, {-1, 0}
-    };
-
-    // Use a set so that we only return unique adjacent tiles
-    set<Tile*> adjacent;
-
-    // Get tiles directly adjecent
-    Location start_location = t1->get_location();
-    for (auto it : directions) {
-        Location new_location = start_location + it;
-        Tile* potential_adjacent = get_tile_at(new_location);
-        if (potential_adjacent) {
-            adjacent.insert(potential_adjacent);
-        }
-    }
-    // Get connected wormholes
-    if (go_through_wormholes and t1->get_wormhole()) {
-        for(Tile* it : wormhole_systems[t1->get_wormhole()]) {
-            if (it != t1) {
-                adjacent.insert(it);
-            }
-        }
-    }
-
-    // Check warp lane connections
-    for (auto warp_connection : warp_connections) {
-        if (warp_connection[0] == start_location) {
-            adjacent.insert(get_tile_at(warp_connection[1]));
-        } else if (warp_connection[1] == start_location) {
-            adjacent.insert(get_tile_at(warp_connection[0]));
-        }
+/* Generates the galaxy described by result, or takes it from the cache if 
+ * there is one. The response holds the galaxy json, its score and seed. A
+ * galaxy that was generated is also returned through galaxy. Results cut off
+ * by the deadline are not cached, since they depend on timing. A traced
+ * request is always generated, so that there is something to trace
+ */
+json generate_response(cxxopts::ParseResult& result, const TileSet& tile_set,
+        const Layout& layout, ResultCache* cache, 
+        chrono::steady_clock::time_point start_time, bool verbose, 
+        unique_ptr<Galaxy>& galaxy, ConvergenceTrace* trace)
+{
+    string key = cache ? cache_key(result, tile_set, layout) : "";
+    json response;
+    if (not key.empty() and not trace and cache->lookup(key, response)) {
+        response["cached"] = true;
+        if (result.count("stats")) {
+            response["stats"] = GeneratorStats().to_json();
+        }
+        return response;
+    }
+
+    unsigned int seed = get_seed(result);
+    galaxy.reset(generate_galaxy(result, tile_set, layout, seed, start_time, 
+                verbose, trace));
+    response["score"] = galaxy->evaluate_grid();
+    response["seed"] = seed;
+    {
+        PhaseTimer timer(galaxy->get_stats(), WRITE_JSON_PHASE);
+        response["galaxy"] = galaxy->to_json();
     }
-
-    list<Tile*> adjacent_list;
-    for (auto t : adjacent) {
-        adjacent_list.push_back(t);
+    if (not key.empty() and galaxy->get_stop_reason() != DEADLINE) {
+        cache->store(key, response);
     }
-
-    return adjacent_list;
-};
-
-struct VisitInfo {
-    Tile* tile;
-    float distance_to;
-};
-
-map<Tile*, float> Galaxy::distance_to_other_tiles(Tile* t1) {
-    map<Tile*, float> visited;
-
-    queue<VisitInfo> to_visit;
-    to_visit.push({t1, 0});
-
-    while (to_visit.size()) {
-        auto cur_tile = to_visit.front().tile;
-        auto distance = to_visit.front().distance_to;
-        to_visit.pop();
-
-        // Skip home systems that are not the start system
-        if (cur_tile->is_home_system() and distance > 0) {
-            continue;
-        }
-
-        // If we didn't already visit the current tile or we got here via a
-        // shorter distance, record the new distance and keep going
-        if ((not visited.count(cur_tile)) or visited[cur_tile] > distance) {
-            visited[cur_tile] = distance;
-
-            float move_cost;
-            switch (cur_tile->get_anomaly()) {
-                case NEBULA: move_cost = 2; break;
-                case ASTEROID_FIELD: move_cost = 1.5; break;
-                case SUPERNOVA: continue;
-                case GRAVITY_RIFT: move_cost = 1; break; 
-                case EMPTY: move_cost = 1.2; break; 
-                default : move_cost = 1;
-            }
-
-            for (auto adjacent : get_adjacent(cur_tile)) {
-                to_visit.push({adjacent, distance + move_cost});
-            }
-        }
+    response["cached"] = false;
+    if (result.count("stats")) {
+        response["stats"] = galaxy->get_stats().to_json();
     }
-    
-    return visited;
+    return response;
 }
 
-double_tile_map Galaxy::calculate_stakes(double_tile_map distances)
+/* Everything --serve and --batch load once and share between requests
+ */
+typedef struct GeneratorContext
 {
-    double_tile_map stakes;
-    for (auto t : placed_tiles) {
-        // Other races have no stakes in each-other's home systems
-        if (t->is_home_system()) {
-            continue;
-        }
-
-        // Skip systems with nothing of value in them
-        if (not (t->get_resource_value() or 
-                    t->get_influence_value() or 
-                    t->get_techcolor())) {
-            continue;
-        }
-
-        float min_dist = 1000;
-        for (auto hs : home_systems) {
-            try {
-                if (distances[hs][t] < min_dist) {
-                    min_dist = distances[hs][t];
-                }
-            }
-            catch (out_of_range) {
-                // Systems like supernovas will not have any path to them
-            }
-        }
-
-        map<Tile*, float> stakes_in_system;
-        for (auto hs : home_systems) {
-            try {
-                if (min_dist < 3 
-                        and evaluate_options["pie_slice_assignment"]
-                        and t != mecatol) {
-                    // Systems close to home systems will be assigned entirely
-                    // to those close home systems
-                    // Never do this for mecatol rex
-                    stakes_in_system[hs] = distances[hs][t] == min_dist ? 1 : 0;
-                } else {
-                    // Systems far away will b split according to inverse distance ^ 2
-                    stakes_in_system[hs] = 1.0 / pow(distances[hs][t], 2);
-                }
-            } catch (out_of_range) {
-                stakes_in_system[hs] = 0;
-            }
-        }
-        float total_stake = 0;
-        for (auto it : stakes_in_system) {
-            total_stake += it.second;
-        }
-        if (total_stake == 0) {
-            continue;
-        }
-        for (auto it : stakes_in_system) {
-            stakes_in_system[it.first] /= total_stake;
-        }
-        stakes[t] = stakes_in_system;
-    }
-    return stakes;
-}
+    TileSet tile_set;
+    map<string, Layout> layouts; // By file name
+    unique_ptr<ResultCache> cache; // NULL without --cache
+    bool limit_requests = false; // Hold requests to the SERVE_MAX_ limits
+} GeneratorContext;
 
-template <class T>
-float average(T l) 
+ResultCache* make_cache(cxxopts::ParseResult& result)
 {
-    float sum = 0;
-    for (auto it : l) {
-        sum += it;
-    }
-    return sum / l.size();
-}
-
-template<class T>
-float coefficient_of_variation(T l) {
-    float sum = 0;
-    float avg = average(l);
-    for (auto it : l) {
-        sum += pow(it - avg, 2);
+    if (not result.count("cache")) {
+        return NULL;
     }
-    return sum / l.size() / avg;
+    return new ResultCache(result["cache"].as<string>(), 
+            result["cache_size_mb"].as<int>() * (1L << 20));
 }
 
-/* Returns true if there exists a supernova tile with a distance to the muaat
- * home system less than or equal to near_dist
+/* The tiles and layouts come from the --db database when it was compiled from
+ * the current version of the file, and from the json file otherwise
  */
-bool Galaxy::is_supernova_near_muaat(int near_dist, double_tile_map distances)
+TileSet get_tiles(string tile_filename, const TileDatabase* db)
 {
-    // Check to see if muaat is in this game
-    int muaat_tile_number = 4;
-    Tile* muaat_home_tile = NULL;
-    for (auto hs : home_systems) {
-        if (hs->get_number() == muaat_tile_number) {
-            muaat_home_tile = hs;
-        }
-    }
-    // No penalty if muaat are not in this game
-    if (not muaat_home_tile) {
-        return 0;
+    TileSet tile_set;
+    if (db and db->read_tiles(tile_filename, tile_set)) {
+        return tile_set;
     }
+    return load_tiles(tile_filename);
+}
 
-    for (auto t : placed_tiles) {
-        if (t->get_anomaly() == SUPERNOVA) {
-            if (distances[muaat_home_tile][t] <= near_dist) {
-                return true;
-            }
-        }
+Layout get_layout(string layout_filename, const TileDatabase* db)
+{
+    Layout layout;
+    if (db and db->read_layout(layout_filename, layout)) {
+        return layout;
     }
-    return false;
+    return load_layout(layout_filename);
 }
 
-/* Returns true if there exists a wormhole tile with a distane to the creuss
- * home system less than or equal to near_dist
- */
-bool Galaxy::winnu_have_clear_path_to_mecatol(double_tile_map distances)
+TileDatabase* make_database(cxxopts::ParseResult& result)
 {
-    // Check to see if Winnu is in this game
-    int winnu_tile_number = 7;
-    Tile* winnu_home_tile = NULL;
-    for (auto hs : home_systems) {
-        if (hs->get_number() == winnu_tile_number) {
-            winnu_home_tile = hs;
-        }
-    }
-    // No penalty if winnu are not in this game
-    if (not winnu_home_tile) {
-        return 0;
+    if (not result.count("db")) {
+        return NULL;
     }
-
-    if (distances[winnu_home_tile][mecatol] <= 3) {
-        return true;
+    TileDatabase* db = new TileDatabase(result["db"].as<string>());
+    if (not db->is_valid()) {
+        cerr << "Ignoring missing or invalid database " 
+            << result["db"].as<string>() << endl;
     }
-    return false;
+    return db;
 }
 
-/* Returns true if there is a clear path for winnu to mecatol
+/* Turns a json request like {"layout": "standard_hex.json", "players": 6, 
+ * "random_homes": true} into the equivalent command line, so that requests 
+ * take exactly the same options as the generator. Flags are set by true
  */
-bool Galaxy::is_wormhole_near_creuss(int near_dist, double_tile_map distances)
+vector<string> request_arguments(const json& request)
 {
-    // Check to see if winnu is in this game
-    int creuss_tile_number = 17;
-    Tile* creuss_home_tile = NULL;
-    for (auto hs : home_systems) {
-        if (hs->get_number() == creuss_tile_number) {
-            creuss_home_tile = hs;
-        }
-    }
-    // No penalty if creuss are not in this game
-    if (not creuss_home_tile) {
-        return 0;
+    if (not request.is_object()) {
+        throw invalid_argument("A request must be a json object");
     }
-
-    for (auto t : placed_tiles) {
-        if (t->get_wormhole() and t->get_wormhole() != DELTA) {
-            if (distances[creuss_home_tile][t] <= near_dist) {
-                return true;
+    vector<string> arguments = {"ti4-map-generator"};
+    for (auto it = request.begin(); it != request.end(); ++it) {
+        if (process_options.count(it.key())) {
+            throw invalid_argument("Option " + it.key() + " cannot be used in a request");
+        }
+        if (it.value().is_boolean()) {
+            if (it.value()) {
+                arguments.push_back("--" + it.key());
             }
+        } else if (it.value().is_string()) {
+            arguments.push_back("--" + it.key() + "=" + it.value().get<string>());
+        } else {
+            arguments.push_back("--" + it.key() + "=" + it.value().dump());
         }
     }
-    return false;
+    return arguments;
 }
 
-bool Galaxy::is_asteroid_near_saar(int near_dist, double_tile_map distances)
+// Most a single --serve request may ask for, so that a few clients cannot
+// start hundreds of optimizer threads in the daemon, run it out of memory or
+// hold its workers for hours
+#define SERVE_MAX_THREADS 4
+#define SERVE_MAX_RESTARTS 64
+#define SERVE_MAX_REPLICAS 32
+#define SERVE_MAX_ISLANDS 16
+#define SERVE_MAX_POPULATION 1024
+#define SERVE_MAX_MUTATION_SWAPS 1000
+#define SERVE_MAX_EVALUATIONS 10000000
+// Every request is cut off by a deadline, which keeps the best galaxy found
+// so far. Requests may ask for a shorter one
+#define SERVE_MAX_DEADLINE_MS 30000
+
+void check_request_limits(cxxopts::ParseResult& result)
 {
-    // Check to see if saar is in this game
-    int saar_tile_number = 11;
-    Tile* saar_home_tile = NULL;
-    for (auto hs : home_systems) {
-        if (hs->get_number() == saar_tile_number) {
-            saar_home_tile = hs;
-        }
+    int n_threads = result["threads"].as<int>();
+    if (n_threads < 1 or n_threads > SERVE_MAX_THREADS) {
+        throw invalid_argument("threads must be between 1 and " 
+                + to_string(SERVE_MAX_THREADS));
     }
-    // No penalty if saar are not in this game
-    if (not saar_home_tile) {
-        return 0;
+    if (result["restarts"].as<int>() > SERVE_MAX_RESTARTS) {
+        throw invalid_argument("restarts must be at most " 
+                + to_string(SERVE_MAX_RESTARTS));
     }
-
-    for (auto t : placed_tiles) {
-        if (t->get_anomaly() == ASTEROID_FIELD) {
-            if (distances[saar_home_tile][t] <= near_dist) {
-                return true;
-            }
-        }
+    if (result["replicas"].as<int>() > SERVE_MAX_REPLICAS) {
+        throw invalid_argument("replicas must be at most " 
+                + to_string(SERVE_MAX_REPLICAS));
     }
-    return false;
-}
-
-void Galaxy::set_evaluate_option(string name, float val)
-{
-    evaluate_options[name] = val;
-}
-
-void Galaxy::print_distances_from(int tile_num)
-{
-    Tile* home_tile = NULL;
-    for (auto hs : home_systems) {
-        if (hs->get_number() == tile_num) {
-            home_tile = hs;
-        }
+    if (result["islands"].as<int>() > SERVE_MAX_ISLANDS) {
+        throw invalid_argument("islands must be at most " 
+                + to_string(SERVE_MAX_ISLANDS));
     }
-    if (not home_tile) {
-        cout << "TIle not found" << endl;
+    if (result["population"].as<int>() > SERVE_MAX_POPULATION) {
+        throw invalid_argument("population must be at most " 
+                + to_string(SERVE_MAX_POPULATION));
     }
-
-    map<Tile*, float> dists = distance_to_other_tiles(home_tile);
-    cout << "Distance from tile " << home_tile->get_number() << " to tile:" << endl;
-    for (auto dist : dists) {
-        cout << "\t" << dist.first->get_number() << " " << dist.second << endl;
+    if (result["mutation_swaps"].as<int>() > SERVE_MAX_MUTATION_SWAPS) {
+        throw invalid_argument("mutation_swaps must be at most " 
+                + to_string(SERVE_MAX_MUTATION_SWAPS));
+    }
+    if (result["max_evaluations"].as<long>() > SERVE_MAX_EVALUATIONS) {
+        throw invalid_argument("max_evaluations must be at most " 
+                + to_string(SERVE_MAX_EVALUATIONS));
     }
 }
 
-int Galaxy::count_home_systems_without_planets()
+/* Parses arguments as if they were given on the command line. options must
+ * outlive the result
+ */
+cxxopts::ParseResult parse_arguments(cxxopts::Options& options, 
+        vector<string> arguments)
 {
-    int count = 0;
-    for (auto t : home_systems) {
-        int n_planet_tiles_adjacent = 0;
-        for (auto a : get_adjacent(t)) {
-            if (a->get_resource_value() || a->get_influence_value()) {
-                n_planet_tiles_adjacent++;
-            }
-        }
-        if (not n_planet_tiles_adjacent) {
-            count++;
-        }
+    vector<char*> argv;
+    for (auto& argument : arguments) {
+        argv.push_back(&argument[0]);
     }
-    return count;
+    int argc = argv.size();
+    char** argv_data = argv.data();
+    return options.parse(argc, argv_data);
 }
 
-int Galaxy::count_adjacent_home_systems()
+/* Checks the arguments of a --serve request against the SERVE_MAX_ limits, 
+ * and adds SERVE_MAX_DEADLINE_MS as its deadline unless it asks for a 
+ * shorter one. The last value given for an option is the one used
+ */
+vector<string> limit_request(vector<string> arguments)
 {
-    int count = 0;
-    for (auto t : home_systems) {
-        for (auto a : get_adjacent(t)) {
-            if (a->is_home_system()) {
-                count++;
-            }
-        }
+    auto options = make_options();
+    auto result = parse_arguments(options, arguments);
+    check_request_limits(result);
+    int deadline_ms = result["deadline_ms"].as<int>();
+    if (deadline_ms <= 0 or deadline_ms > SERVE_MAX_DEADLINE_MS) {
+        arguments.push_back("--deadline_ms=" + to_string(SERVE_MAX_DEADLINE_MS));
     }
-    return count;
+    return arguments;
 }
 
-int Galaxy::count_adjacent_anomalies()
+/* Generates the galaxy asked for by one request. Layouts are looked up by 
+ * file name, whatever directory the request names
+ */
+json handle_request(const json& request, const GeneratorContext& context)
 {
-    int count = 0;
-    for (auto t : placed_tiles) {
-        if (t->get_anomaly() and t->get_anomaly() != EMPTY) {
-            for (auto a : get_adjacent(t)) {
-                if (a->get_anomaly() and a->get_anomaly() != EMPTY) {
-                    count++;
-                }
-            }
-        }
+    auto start_time = chrono::steady_clock::now();
+
+    auto arguments = request_arguments(request);
+    if (context.limit_requests) {
+        arguments = limit_request(arguments);
     }
-    return count;
-}
+    auto options = make_options();
+    auto result = parse_arguments(options, arguments);
 
-int Galaxy::count_adjacent_wormholes()
-{
-    int count = 0;
-    for (auto t : placed_tiles) {
-        if (t->get_wormhole()) {
-            for (auto a : get_adjacent(t, false)) {
-                if (t->get_wormhole() == a->get_wormhole()) {
-                    count++;
-                }
-            }
-        }
+    if (not result.count("layout")) {
+        throw invalid_argument("A request must name a layout");
     }
-    return count;
+    string layout_name = result["layout"].as<string>();
+    layout_name = layout_name.substr(layout_name.rfind('/') + 1);
+    auto layout = context.layouts.find(layout_name);
+    if (layout == context.layouts.end()) {
+        throw invalid_argument("Unknown layout " + layout_name);
+    }
+
+    unique_ptr<Galaxy> galaxy;
+    return generate_response(result, context.tile_set, layout->second, 
+            context.cache.get(), start_time, false, galaxy, NULL);
 }
 
-float Galaxy::first_turn_variance(double_tile_map stakes, Scores& scores)
+bool send_line(int fd, string line)
 {
-    list<float> first_turn_shares;
-    for (auto home_system : home_systems) {
-        vector<float> res_infs;
-        for (auto tile : get_adjacent(home_system)) {
-            res_infs.push_back(tile->get_res_inf_value() * stakes[tile][home_system]);
+    line += "\n";
+    for (size_t sent = 0; sent < line.size(); ) {
+        ssize_t n = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
         }
-        sort(res_infs.begin(), res_infs.end(), [](float a, float b) {return a > b;});
-        float res_inf = res_infs[0] + res_infs[1];
-        first_turn_shares.push_back(res_inf);
-        scores.first_turn_share[home_system] = res_inf;
+        sent += n;
     }
-    return coefficient_of_variation(first_turn_shares);
+    return true;
 }
 
-Scores Galaxy::calculate_shares(double_tile_map stakes)
-{
-    Scores scores;
-
-    float total_resources = 0;
-    float total_influence = 0;
-    for (auto home_system : home_systems) {
-        float resource_share = 0;
-        float influence_share = 0;
-        float res_inf_share = 0;
-        float tech_share = 0;
-        for (auto tile : placed_tiles) {
-            if (tile->is_home_system()) {
-                continue;
+/* Answers each line of json read from a client with one line of json, 
+ * either the response or {"error": message}, until the client hangs up
+ */
+void serve_connection(int fd, const GeneratorContext& context)
+{
+    string pending;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        pending.append(buffer, n);
+        size_t end;
+        while ((end = pending.find('\n')) != string::npos) {
+            string line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+
+            json response;
+            try {
+                response = handle_request(json::parse(line), context);
+            } catch (exception& e) {
+                response = {{"error", e.what()}};
+            }
+            if (not send_line(fd, response.dump())) {
+                close(fd);
+                return;
             }
-            float res = tile->get_resource_value() * stakes[tile][home_system];
-            float inf = tile->get_influence_value() * stakes[tile][home_system];
-            resource_share += res;
-            influence_share += inf;
-            res_inf_share += tile->get_res_inf_value() * stakes[tile][home_system];
-            tech_share += tile->get_techcolor() ? stakes[tile][home_system] : 0;
         }
-        scores.resource_share[home_system] = resource_share;
-        scores.influence_share[home_system] = influence_share;
-        scores.res_inf_share[home_system] = res_inf_share;
-        scores.tech_share[home_system] = tech_share;
-
-        total_resources += resource_share;
-        total_influence += influence_share;
     }
-
-    return scores;
+    close(fd);
 }
 
-template<class K, class V>
-list<V> get_values_of_map(map<K, V> a)
-{
-    list<V> ret;
-    for (auto elem : a) {
-        ret.push_back(elem.second);
-    }
-    return ret;
-}
+// Connections accepted while this many are waiting for a worker are turned
+// away, and clients that send nothing for this long are hung up on
+#define SERVE_MAX_PENDING 64
+#define SERVE_IDLE_TIMEOUT_S 60
 
-float Galaxy::apply_penalties(double_tile_map distances)
+/* Opens a unix socket at socket_path that only the daemon's user and group
+ * can connect to. A stale socket left by a daemon that died is replaced, but
+ * one a running daemon still listens on, or any other file, is left alone.
+ * Returns -1 if it cannot listen
+ */
+int listen_on(string socket_path)
 {
-    float total_penalty = 0;
-
-    map<string, float> penalties;
-
-    float penalty;
-    penalty = count_home_systems_without_planets() * 10;
-    scores.penalties["home systems without planets (x10)"] = penalty;
-    total_penalty += penalty;
-    penalty = count_adjacent_home_systems() * 5;
-    scores.penalties["adjacent home systems (x5)"] = penalty;
-    total_penalty += penalty;
-    penalty = count_adjacent_anomalies();
-    scores.penalties["adjacent anomalies (x1)"] = penalty;
-    total_penalty += penalty;
-    penalty = count_adjacent_wormholes() * 2;
-    scores.penalties["adjacent wormholes (x2)"] = penalty;
-    total_penalty += penalty;
-
-    // Some race specific options if requested. the large total_penalty penalty ensures
-    // that these will be satisfied if possible
-    if (evaluate_options["muaat_gets_supernova"]) {
-        if (not is_supernova_near_muaat(evaluate_options["muaat_gets_supernova"], 
-                    distances)) {
-            total_penalty += 10;
-            scores.penalties["muaat does not have supernova (x10)"] = 10;
-        }
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path too long: " << socket_path << endl;
+        return -1;
     }
-    if (evaluate_options["creuss_gets_wormhole"]) {
-        if (not is_wormhole_near_creuss(evaluate_options["creuss_gets_wormhole"], 
-                    distances)) {
-            total_penalty += 10;
-            scores.penalties["cruess does not have wormhole (x10)"] = 10;
+    strcpy(address.sun_path, socket_path.c_str());
+
+    struct stat status;
+    if (lstat(socket_path.c_str(), &status) == 0) {
+        if (not S_ISSOCK(status.st_mode)) {
+            cerr << socket_path << " exists and is not a socket" << endl;
+            return -1;
         }
-    }
-    if (evaluate_options["saar_get_asteroids"]) {
-        if (not is_asteroid_near_saar(evaluate_options["saar_get_asteroids"], 
-                    distances)) {
-            total_penalty += 10;
-            scores.penalties["Saar do not have asteroids (x10)"] = 10;
+        int probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe_fd >= 0 
+            and connect(probe_fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+        if (probe_fd >= 0) {
+            close(probe_fd);
         }
-    }
-    if (evaluate_options["winnu_have_clear_path_to_mecatol"]) {
-        if (not winnu_have_clear_path_to_mecatol( distances)) {
-            total_penalty += 10;
-            scores.penalties["winnu does not have a clear path to mecatol (x10)"] = 10;
+        if (live) {
+            cerr << "Another daemon is already serving on " << socket_path << endl;
+            return -1;
         }
+        unlink(socket_path.c_str());
     }
-    
-    return total_penalty;
-}
 
-int num_planets_with_trait(Tile* tile, PlanetTrait trait)
-{
-    int count = 0;
-    for (auto p : tile->get_planets()) {
-        if (trait == p.trait) {
-            count ++;
-        }
+    // Nobody can connect before listen, so the mode is set in time
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0 
+            or bind(server_fd, (struct sockaddr*) &address, sizeof(address)) 
+            or chmod(socket_path.c_str(), 0660)
+            or listen(server_fd, SOMAXCONN)) {
+        cerr << "Could not listen on " << socket_path << endl;
+        return -1;
     }
-    return count;
+    return server_fd;
 }
 
-float Galaxy::calculate_trait_variance(double_tile_map stakes)
-{
-    list<float> counts;
-
-    for (auto hs : home_systems)
-    {
-        int count = 0;
-        for (PlanetTrait trait : {CULTURAL, HAZARDOUS, INDUSTRIAL}) {
-            for (auto t : placed_tiles) {
-                if (t->is_home_system()) {
-                    continue;
-                }
-                count += num_planets_with_trait(t, trait) * stakes[t][hs];
+/* Generates galaxies for the clients of the unix socket listened on by
+ * server_fd. Connections are served by a fixed pool of n_threads workers and
+ * wait in a queue until one is free
+ */
+void serve(int server_fd, int n_threads, const GeneratorContext& context)
+{
+    cerr << "Serving with " << n_threads << " workers" << endl;
+
+    mutex queue_mutex;
+    condition_variable queue_ready;
+    deque<int> waiting;
+    auto work = [&]() {
+        while (true) {
+            int fd;
+            {
+                unique_lock<mutex> lock(queue_mutex);
+                queue_ready.wait(lock, [&]() { return not waiting.empty(); });
+                fd = waiting.front();
+                waiting.pop_front();
             }
+            serve_connection(fd, context);
         }
-        counts.push_back(count);
+    };
+    vector<thread> workers;
+    for (int i = 0; i < n_threads; i++) {
+        workers.push_back(thread(work));
     }
-    return coefficient_of_variation(counts);
-}
-
-float Galaxy::calculate_ring_balance(map<Tile*, float> distances_from_mecatol) {
-    vector<vector<Tile*>> tilesByRing;
-    tilesByRing.resize(3);
 
-    vector<float> resByRing = {0, 0, 0};
-    vector<float> infByRing = {0, 0, 0};
-    vector<float> techByRing = {0, 0, 0};
-    vector<int> countByRing = {0, 0, 0};
-
-    // add up res/inf/tech values by ring
-    for (pair<Tile*, float> p : distances_from_mecatol) {
-	Tile* tile = p.first;
-	float distance = p.second;
-        if (tile->is_home_system()) {
+    struct timeval idle_timeout = {SERVE_IDLE_TIMEOUT_S, 0};
+    while (true) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd < 0) {
             continue;
         }
-        int ring;
-        if (distance <= 1.0) {
-            ring = 0;
-        } else if (distance <= 2.0) {
-            ring = 1;
-        } else {
-            ring = 2;
-        }
-        
-        resByRing[ring] += tile->get_resource_value();
-        infByRing[ring] += tile->get_influence_value();
-        techByRing[ring] += tile->get_techcolor() ? 1 : 0;
-        countByRing[ring]++;
-    }
-
-    // calc average values per ring
-    for (int ring = 0; ring < 3; ring++) {
-        resByRing[ring] /= max(countByRing[ring], 1);
-        infByRing[ring] /= max(countByRing[ring], 1);
-        techByRing[ring] /= max(countByRing[ring], 1);
-    }
-
-    // skew toward mecatol based on ring_balance
-    resByRing[0] /= evaluate_options["ring_balance"];
-    infByRing[0] /= evaluate_options["ring_balance"];
-    techByRing[0] /= evaluate_options["ring_balance"];
-
-    resByRing[2] *= evaluate_options["ring_balance"];
-    infByRing[2] *= evaluate_options["ring_balance"];
-    techByRing[2] *= evaluate_options["ring_balance"];
-
-    float ringScore = 
-        coefficient_of_variation(resByRing) * evaluate_options["resource_weight"]
-        + coefficient_of_variation(infByRing) * evaluate_options["influence_weight"]
-        + coefficient_of_variation(techByRing) * evaluate_options["tech_weight"];
-    ringScore /= 3;
+        setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &idle_timeout, 
+                sizeof(idle_timeout));
 
-    return ringScore;
-}
-
-float Galaxy::evaluate_grid() {
-    
-    double_tile_map distances_from_home_systems;
-
-    for (auto home_system : home_systems) {
-        distances_from_home_systems[home_system] = distance_to_other_tiles(home_system);
-    }
-    auto distances_from_mecatol = distance_to_other_tiles(mecatol);
-
-    stakes = calculate_stakes(distances_from_home_systems);
-
-    float score = 0;
-
-    scores = calculate_shares(stakes);
-
-    score += first_turn_variance(stakes, scores) * evaluate_options["first_turn"]; 
-
-    if (evaluate_options.count("ring_balance")) {
-        score += calculate_ring_balance(distances_from_mecatol) * evaluate_options["ring_balance_weight"];
+        unique_lock<mutex> lock(queue_mutex);
+        if (waiting.size() >= SERVE_MAX_PENDING) {
+            lock.unlock();
+            send_line(client_fd, json({{"error", "Too many connections"}}).dump());
+            close(client_fd);
+            continue;
+        }
+        waiting.push_back(client_fd);
+        queue_ready.notify_one();
     }
-
-    score += apply_penalties(distances_from_home_systems);
-
-    score += calculate_trait_variance(stakes) * evaluate_options["trait_weight"];
-
-    score += coefficient_of_variation(get_values_of_map(scores.resource_share)) * evaluate_options["resource_weight"]
-           + coefficient_of_variation(get_values_of_map(scores.influence_share)) * evaluate_options["influence_weight"]
-           + coefficient_of_variation(get_values_of_map(scores.tech_share)) * evaluate_options["tech_weight"];
-    score += coefficient_of_variation(get_values_of_map(scores.res_inf_share)) * evaluate_options["res_inf_weight"];; 
-
-    return score;
 }
 
-void Galaxy::swap_tiles(Tile* a, Tile* b)
-{
-    Location a_start = a->get_location();
-    Location b_start = b->get_location();
-
-    place_tile(a_start, b);
-    place_tile(b_start, a);
-}
-
-/* Returns every possible combination of swappable tiles
+/* Generates a galaxy for every line of a jsonl file of requests on n_threads
+ * threads. Each result is written to out as one line of json as soon as it 
+ * is ready, so they come out of order and carry the line number of their 
+ * request
  */
-vector<pair<Tile*, Tile*>> Galaxy::make_swap_list()
+void run_batch(string filename, int n_threads, const GeneratorContext& context,
+        ostream& out)
 {
-    vector<pair<Tile*, Tile*>> swap_list;
-    for (auto t1 = movable_systems.begin(); t1 != movable_systems.end(); t1++) {
-        auto t2 = t1;
-        advance(t2, 1);
-        for (; t2 != movable_systems.end(); t2++) {
-            swap_list.push_back({*t1, *t2});
+    ifstream batch_file(filename);
+    if (not batch_file) {
+        cerr << "Could not open " << filename << endl;
+        exit(-1);
+    }
+    vector<pair<int, string>> requests;
+    string line;
+    for (int line_number = 1; getline(batch_file, line); line_number++) {
+        if (line.find_first_not_of(" \t\r") != string::npos) {
+            requests.push_back({line_number, line});
         }
     }
-    random_shuffle(swap_list.begin(), swap_list.end());
-    return swap_list;
-}
 
-/* optimize_grid
- * Swaps tiles to maximize the score of the current grid until no more swaps 
- * can be made. The score is defined by evaluate_grid
- */
-void Galaxy::optimize_grid()
-{
-    float current_score = evaluate_grid();
-    bool better_score_found = 0;
-
-    int n_swaps = 0;
-    // Set to a very high value to test all swaps
-    int swaps_until_quit = 10000;
-
-    do {
-        better_score_found = false;
-        auto swaps = make_swap_list();
-
-        n_swaps = 0;
-        for (auto swap : swaps) {
-            swap_tiles(swap.first, swap.second);
-            float new_score = evaluate_grid();
-            if (new_score < current_score) {
-                better_score_found = true;
-                current_score = new_score;
-                printf("Swapping tiles %d & %d, new_score: %0.3f\n", 
-                        swap.first->get_number(), swap.second->get_number(), 
-                        current_score);
-                break;
-            } else {
-                swap_tiles(swap.first, swap.second);
-            }
-            n_swaps++;
-            if (n_swaps > swaps_until_quit) {
-                break;
+    atomic<int> next_request(0);
+    mutex out_mutex;
+    auto run_requests = [&]() {
+        for (int i = next_request++; i < (int) requests.size(); i = next_request++) {
+            json response;
+            try {
+                response = handle_request(json::parse(requests[i].second), 
+                        context);
+            } catch (exception& e) {
+                response = {{"error", e.what()}};
             }
-        }
-    } while (better_score_found and n_swaps < swaps_until_quit);
-}
+            response["line"] = requests[i].first;
 
-void Galaxy::write_json(string filename)
-{
-    json j;
-
-    // Record tile hex grid layout
-    j["grid"] = json::array();
-    for (int i = 0; i < (int) grid.size(); i++) {
-        auto row = json::array();
-        for (int j = 0; j < (int) grid[i].size(); j++) {
-            row.push_back(grid[i][j]->get_number());
+            lock_guard<mutex> lock(out_mutex);
+            out << response.dump() << endl;
         }
-        j["grid"].push_back(row);
-    }
-
-    // Record any warp connectiongs
-    for (auto wc : warp_connections) {
-        j["warp_connections"].push_back({{wc[0].i, wc[0].j}, {wc[1].i, wc[1].j}}); }
-
-    // Record the overal scores and stakes in each system
-    for (auto it : scores.resource_share) {
-        auto hs = it.first;
-        j["scores"][hs->get_race()]["resource"] = scores.resource_share[hs];
-        j["scores"][hs->get_race()]["influence"] = scores.influence_share[hs];
-        j["scores"][hs->get_race()]["tech"] = scores.tech_share[hs];
-        j["scores"][hs->get_race()]["res_inf"] = scores.res_inf_share[hs];
-        j["scores"][hs->get_race()]["first_turn"] = scores.first_turn_share[hs];
+    };
 
+    vector<thread> threads;
+    for (int i = 1; i < n_threads; i++) {
+        threads.push_back(thread(run_requests));
     }
-
-    for (auto it : stakes) {
-        for (auto it2: it.second) {
-            Tile* t = it.first;
-            Tile* hs = it2.first;
-            float stake = stakes[t][hs];
-            j["stakes"][to_string(t->get_number())][hs->get_race()] = stake;
-        }
+    run_requests();
+    for (auto& t : threads) {
+        t.join();
     }
-
-    j["mecatol"] = {mecatol->get_location().i, mecatol->get_location().j};
-
-    j["penalties"] = scores.penalties;
-    
-    cerr << "Writing result to " << filename << endl;
-    ofstream galaxy_output_file;
-    galaxy_output_file.open(filename);
-    galaxy_output_file << j;
-    galaxy_output_file.close();
 }
 
 int main(int argc, char *argv[]) {
+    auto start_time = chrono::steady_clock::now();
 
-    cxxopts::Options options("ti4-map-generator", "Generate balanced TI4 maps");
-    options.add_options()
-            ("h,help", "Print help")
-            ("t,tiles", "json file defining tile properites", cxxopts::value<std::string>())
-            ("l,layout", "json file defining galaxy shape", cxxopts::value<std::string>())
-            ("o,output", "galaxy json output filename", cxxopts::value<std::string>())
-            ("p,players", "number of players", cxxopts::value<int>()->default_value("6"))
-            ("s,seed", "random seed", cxxopts::value<int>())
-            ("star_by_star", "allow free placement of home systems")
-            ("dummy_homes", "use blank home systems (default)")
-            ("random_homes", "use random race home systems")
-            ("choose_homes", "use with --races option")
-            ("pie_slice_assignment", "Assign systems <= 2 spaces away from a home systems entirely to the(those) home systems <=2 away")
-            ("r,races", "list of home system tile numbers like so \"1 2 5...\"", cxxopts::value<string>()->default_value("6"))
-            ("mandatory_tiles", "List of mandatory tiles to include", cxxopts::value<string>())
-            ("creuss_gets_wormhole", "If creuss in game place a wormhole within x distance of it", cxxopts::value<int>()->default_value("1"))
-            ("muaat_gets_supernova", "If muaat in game place the supernova within x distance of it", cxxopts::value<int>()->default_value("1"))
-            ("winnu_have_clear_path_to_mecatol", "If winnu in game give them a clear path to mecatol", cxxopts::value<int>()->default_value("1"))
-            ("saar_get_asteroids", "If Saar are in the game give them an asteroid field", cxxopts::value<int>()->default_value("1"))
-            ("resource_weight", "Relative weight of resource variance", cxxopts::value<float>()->default_value("1.0"))
-            ("influence_weight", "Relative weight of infuence variance", cxxopts::value<float>()->default_value("1.0"))
-            ("res_inf_weight", "Relative weight of max(res,2/3inf)", cxxopts::value<float>()->default_value("1.0"))
-            ("trait_weight", "Relative weight of planet trait variance", cxxopts::value<float>()->default_value("0.3"))
-            ("tech_weight", "Relative weight of tech specialty variance", cxxopts::value<float>()->default_value("1.0"))
-            ("first_turn", "Relative weight of first turn res+2/3inf", cxxopts::value<float>()->default_value("1.0"))
-            ("ring_balance_weight", "Relative weight of ring balancing", cxxopts::value<float>()->default_value("1.0"))
-            ("ring_balance", "Put higher value systems closer/farther balanced from mecatol", cxxopts::value<float>())
-            ("res_value_of_inf", "Relative weight of ring balancing", cxxopts::value<float>()->default_value("0.667"))
-            ;
+    auto options = make_options();
     auto result = options.parse(argc, argv);
 
 	if (result.count("help"))
@@ -1454,6 +773,53 @@ int main(int argc, char *argv[]) {
       exit(0);
     }
 
+    if (result.count("compile_db")) {
+        if (not result.count("tiles")) {
+            std::cerr << options.help({""}) << std::endl;
+            exit(-1);
+        }
+        compile_database(result["compile_db"].as<string>(), 
+                result["tiles"].as<string>(), 
+                list_layouts(result["layouts"].as<string>()));
+        return 0;
+    }
+
+    unique_ptr<TileDatabase> db(make_database(result));
+
+    if (result.count("serve") or result.count("batch")) {
+        if (not result.count("tiles")) {
+            std::cerr << options.help({""}) << std::endl;
+            exit(-1);
+        }
+
+        // Listen before loading anything, so a second daemon fails at once
+        int server_fd = -1;
+        if (result.count("serve")) {
+            server_fd = listen_on(result["serve"].as<string>());
+            if (server_fd < 0) {
+                exit(-1);
+            }
+        }
+        GeneratorContext context;
+        context.tile_set = get_tiles(result["tiles"].as<string>(), db.get());
+        for (auto filename : list_layouts(result["layouts"].as<string>())) {
+            context.layouts[filename.substr(filename.rfind('/') + 1)] 
+                = get_layout(filename, db.get());
+        }
+        context.cache.reset(make_cache(result));
+
+        int n_threads = result["threads"].as<int>();
+        if (n_threads <= 0) {
+            n_threads = MAX((int) thread::hardware_concurrency(), 1);
+        }
+        if (result.count("serve")) {
+            context.limit_requests = true;
+            serve(server_fd, n_threads, context);
+        }
+        run_batch(result["batch"].as<string>(), n_threads, context, cout);
+        return 0;
+    }
+
     if (not result.count("tiles") or not result.count("output")) {
         std::cerr << options.help({""}) << std::endl;
         exit(-1);
@@ -1464,77 +830,67 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    if (not result.count("seed")) {
-        srand(time(NULL));
-    } else {
-        srand(result["seed"].as<int>());
-    }
+    auto import_start = chrono::steady_clock::now();
+    TileSet tile_set = get_tiles(result["tiles"].as<string>(), db.get());
+    Layout layout = get_layout(result["layout"].as<string>(), db.get());
+    double import_ms = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - import_start).count();
 
-    HomeSystemSetups hss = DUMMY;
-    string races;
+    unique_ptr<ResultCache> cache(make_cache(result));
 
-    if (result.count("random_homes")) {
-        hss = RANDOM_RACES;
-    }
-    if (result.count("choose_homes")) {
-        hss = CHOSEN_RACES;
-        if (not result.count("races")) {
-            cerr << "Must also provide list of races with -r option" << endl;
-            exit(-1);
+    unique_ptr<Galaxy> galaxy;
+    unique_ptr<ConvergenceTrace> trace;
+    json response;
+    try {
+        if (result.count("trace")) {
+            trace.reset(new ConvergenceTrace(result["trace_size"].as<long>()));
         }
-        races = result["races"].as<string>();
+        response = generate_response(result, tile_set, layout, cache.get(), 
+                start_time, true, galaxy, trace.get());
+    } catch (logic_error& e) {
+        cerr << e.what() << endl;
+        exit(-1);
     }
-
-    string mandatory_tiles = "";
-    if (result.count("mandatory_tiles")) {
-        mandatory_tiles = result["mandatory_tiles"].as<string>();
+    cout << "Score: " << response["score"].get<float>() << endl;
+    if (galaxy) {
+        galaxy->print_grid();
     }
 
-    Galaxy galaxy(result["tiles"].as<string>(), result["layout"].as<string>(), 
-            result["players"].as<int>(), hss, races, mandatory_tiles, 
-            result.count("star_by_star") ? true : false);
-    float score = galaxy.evaluate_grid();
-    cout << "Score: " << score << endl;
-
-    galaxy.set_evaluate_option("creuss_gets_wormhole", 
-            result["creuss_gets_wormhole"].as<int>());
-    galaxy.set_evaluate_option("muaat_gets_supernova", 
-            result["muaat_gets_supernova"].as<int>());
-    galaxy.set_evaluate_option("winnu_have_clear_path_to_mecatol", 
-            result["winnu_have_clear_path_to_mecatol"].as<int>());
-    galaxy.set_evaluate_option("saar_get_asteroids", 
-            result["saar_get_asteroids"].as<int>());
-
-    galaxy.set_evaluate_option("resource_weight", 
-            result["resource_weight"].as<float>());
-    galaxy.set_evaluate_option("res_inf_weight", 
-            result["res_inf_weight"].as<float>());
-    galaxy.set_evaluate_option("influence_weight", 
-            result["influence_weight"].as<float>());
-    galaxy.set_evaluate_option("tech_weight", 
-            result["tech_weight"].as<float>());
-    galaxy.set_evaluate_option("tech_weight", 
-            result["trait_weight"].as<float>());
-    galaxy.set_evaluate_option("ring_balance_weight", 
-            result["ring_balance_weight"].as<float>());
-    galaxy.set_evaluate_option("res_value_of_inf", 
-            result["res_value_of_inf"].as<float>());
-    galaxy.set_evaluate_option("first_turn", 
-            result["first_turn"].as<float>());
-
-    if (result.count("pie_slice_assignment")) {
-        galaxy.set_evaluate_option("pie_slice_assignment", 1);
-    }
+    string output_filename = result["output"].as<string>();
+    cerr << "Writing result to " << output_filename << endl;
+    auto write_start = chrono::steady_clock::now();
+    ofstream galaxy_output_file(output_filename);
+    galaxy_output_file << response["galaxy"];
+    galaxy_output_file.close();
 
-    if (result.count("ring_balance")) {
-        galaxy.set_evaluate_option("ring_balance", result["ring_balance"].as<float>());
+    if (result.count("stats")) {
+        json& stats = response["stats"];
+        stats["phases_ms"]["import"] = import_ms;
+        stats["phases_ms"]["write_json"] = stats["phases_ms"]["write_json"].get<double>()
+            + chrono::duration<double, milli>(
+                    chrono::steady_clock::now() - write_start).count();
+
+        // galaxy.json gets its stats in galaxy.stats.json
+        string stats_filename = output_filename;
+        if (stats_filename.size() > 5 
+                and stats_filename.substr(stats_filename.size() - 5) == ".json") {
+            stats_filename.resize(stats_filename.size() - 5);
+        }
+        stats_filename += ".stats.json";
+        cerr << "Writing stats to " << stats_filename << endl;
+        ofstream stats_file(stats_filename);
+        stats_file << stats.dump(4) << endl;
     }
 
-    galaxy.optimize_grid();
-    score = galaxy.evaluate_grid();
-    cout << "Score: " << score << endl;
-    galaxy.print_grid();
-    galaxy.write_json(result["output"].as<string>());
+    if (trace) {
+        cerr << "Writing " << trace->size() << " moves to " 
+            << result["trace"].as<string>();
+        if (trace->n_dropped()) {
+            cerr << ", the first " << trace->n_dropped() << " were dropped";
+        }
+        cerr << endl;
+        trace->write(result["trace"].as<string>());
+    }
 
     return 0;
 }
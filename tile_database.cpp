@@ -0,0 +1,372 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tile_database.hpp"
+
+static const char db_magic[8] = {'T', 'I', '4', 'M', 'A', 'P', 'D', 'B'};
+
+/* Size and modification time of a file, false if it cannot be read
+ */
+static bool stat_source(string filename, int64_t& size, int64_t& mtime_ns)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info)) {
+        return false;
+    }
+    size = info.st_size;
+    mtime_ns = info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    return true;
+}
+
+/* Collects the records of each section while a database is compiled
+ */
+struct DbBuilder
+{
+    vector<DbSource> sources;
+    vector<DbTile> tiles;
+    vector<DbPlanet> planets;
+    vector<DbLayout> layouts;
+    vector<DbLocation> locations;
+    vector<DbFixedTile> fixed_tiles;
+    vector<DbPlayerSetup> player_setups;
+    string strings;
+
+    DbString add_string(const string& s) {
+        DbString db_string = {(uint32_t) strings.size(), (uint32_t) s.size()};
+        strings += s;
+        return db_string;
+    }
+
+    uint32_t add_source(string filename, const string& digest) {
+        DbSource source = {};
+        source.path = add_string(filename);
+        if (not stat_source(filename, source.size, source.mtime_ns)) {
+            cerr << "Could not read " << filename << endl;
+            exit(-1);
+        }
+        strncpy(source.digest, digest.c_str(), sizeof(source.digest) - 1);
+        sources.push_back(source);
+        return sources.size() - 1;
+    }
+
+    void add_tile(Tile tile, DbTileGroup group) {
+        DbTile db_tile;
+        db_tile.number = tile.get_number();
+        db_tile.group = group;
+        db_tile.wormhole = tile.get_wormhole();
+        db_tile.anomaly = tile.get_anomaly();
+        db_tile.race = add_string(tile.get_race());
+        db_tile.first_planet = planets.size();
+        for (auto& planet : tile.get_planets()) {
+            planets.push_back({add_string(planet.name), planet.resources,
+                    planet.influence, planet.trait, planet.tech});
+        }
+        db_tile.n_planets = planets.size() - db_tile.first_planet;
+        tiles.push_back(db_tile);
+    }
+
+    void add_layout(const Layout& layout, uint32_t source) {
+        DbLayout db_layout;
+        db_layout.source = source;
+
+        db_layout.first_location = locations.size();
+        for (auto& l : layout.valid_locations) {
+            locations.push_back({l.i, l.j});
+        }
+        db_layout.n_locations = layout.valid_locations.size();
+
+        db_layout.first_fixed_tile = fixed_tiles.size();
+        for (auto& fixed_tile : layout.fixed_tiles) {
+            fixed_tiles.push_back({fixed_tile.first,
+                    {fixed_tile.second.i, fixed_tile.second.j}});
+        }
+        db_layout.n_fixed_tiles = layout.fixed_tiles.size();
+
+        db_layout.first_player_setup = player_setups.size();
+        for (auto& setup : layout.player_setups) {
+            DbPlayerSetup db_setup;
+            db_setup.n_players = setup.first;
+            db_setup.n_blue = setup.second.n_blue;
+            db_setup.n_red = setup.second.n_red;
+            db_setup.first_location = locations.size();
+            for (auto& l : setup.second.start_positions) {
+                locations.push_back({l.i, l.j});
+            }
+            db_setup.n_locations = setup.second.start_positions.size();
+            player_setups.push_back(db_setup);
+        }
+        db_layout.n_player_setups = layout.player_setups.size();
+
+        db_layout.first_warp_location = locations.size();
+        for (auto& connection : layout.warp_connections) {
+            locations.push_back({connection[0].i, connection[0].j});
+            locations.push_back({connection[1].i, connection[1].j});
+        }
+        db_layout.n_warp_connections = layout.warp_connections.size();
+        layouts.push_back(db_layout);
+    }
+};
+
+/* Appends a section to the file contents, 8 byte aligned
+ */
+template <class Record>
+static DbSection append_section(string& contents, const Record* records,
+        size_t count)
+{
+    contents.resize((contents.size() + 7) / 8 * 8);
+    DbSection section = {contents.size(), count};
+    contents.append((const char*) records, count * sizeof(Record));
+    return section;
+}
+
+/* Parses the json files and writes them out as a database. The file is
+ * written next to db_filename first and renamed into place, so running
+ * generators never map half a database
+ */
+void compile_database(string db_filename, string tile_filename,
+        const vector<string>& layout_filenames)
+{
+    DbBuilder builder;
+
+    TileSet tile_set = load_tiles(tile_filename);
+    builder.add_source(tile_filename, tile_set.digest);
+    for (auto& tile : tile_set.red_tiles) {
+        builder.add_tile(tile, DB_RED_TILE);
+    }
+    for (auto& tile : tile_set.blue_tiles) {
+        builder.add_tile(tile, DB_BLUE_TILE);
+    }
+    for (auto& tile : tile_set.home_tiles) {
+        builder.add_tile(tile, DB_HOME_TILE);
+    }
+    builder.add_tile(tile_set.mecatol, DB_MECATOL);
+
+    for (auto& layout_filename : layout_filenames) {
+        Layout layout = load_layout(layout_filename);
+        builder.add_layout(layout, builder.add_source(layout_filename, layout.digest));
+    }
+
+    DbHeader header = {};
+    memcpy(header.magic, db_magic, sizeof(db_magic));
+    header.version = TILE_DATABASE_VERSION;
+
+    string contents(sizeof(DbHeader), '\0');
+    header.sources = append_section(contents, builder.sources.data(),
+            builder.sources.size());
+    header.tiles = append_section(contents, builder.tiles.data(),
+            builder.tiles.size());
+    header.planets = append_section(contents, builder.planets.data(),
+            builder.planets.size());
+    header.layouts = append_section(contents, builder.layouts.data(),
+            builder.layouts.size());
+    header.locations = append_section(contents, builder.locations.data(),
+            builder.locations.size());
+    header.fixed_tiles = append_section(contents, builder.fixed_tiles.data(),
+            builder.fixed_tiles.size());
+    header.player_setups = append_section(contents, builder.player_setups.data(),
+            builder.player_setups.size());
+    header.strings = append_section(contents, builder.strings.data(),
+            builder.strings.size());
+    header.file_size = contents.size();
+    header.checksum = fnv1a_hash(contents.data() + sizeof(DbHeader),
+            contents.size() - sizeof(DbHeader));
+    memcpy(&contents[0], &header, sizeof(DbHeader));
+
+    string temporary_filename = db_filename + ".tmp." + to_string(getpid());
+    ofstream db_file(temporary_filename, ios::binary);
+    db_file.write(contents.data(), contents.size());
+    db_file.close();
+    if (not db_file or rename(temporary_filename.c_str(), db_filename.c_str())) {
+        unlink(temporary_filename.c_str());
+        cerr << "Could not write " << db_filename << endl;
+        exit(-1);
+    }
+    cerr << "Compiled " << builder.tiles.size() << " tiles and "
+        << builder.layouts.size() << " layouts into " << db_filename << endl;
+}
+
+TileDatabase::TileDatabase(string db_filename)
+{
+    int fd = open(db_filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) or info.st_size < (off_t) sizeof(DbHeader)) {
+        close(fd);
+        return;
+    }
+    void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+    data = (const char*) mapping;
+    size = info.st_size;
+
+    const DbHeader* candidate = (const DbHeader*) data;
+    if (memcmp(candidate->magic, db_magic, sizeof(db_magic))
+            or candidate->version != TILE_DATABASE_VERSION
+            or candidate->file_size != size
+            or candidate->checksum != fnv1a_hash(data + sizeof(DbHeader),
+                size - sizeof(DbHeader))) {
+        return;
+    }
+    header = candidate;
+    if (not section<DbSource>(header->sources)
+            or not section<DbTile>(header->tiles)
+            or not section<DbPlanet>(header->planets)
+            or not section<DbLayout>(header->layouts)
+            or not section<DbLocation>(header->locations)
+            or not section<DbFixedTile>(header->fixed_tiles)
+            or not section<DbPlayerSetup>(header->player_setups)
+            or not section<char>(header->strings)) {
+        header = NULL;
+    }
+}
+
+TileDatabase::~TileDatabase()
+{
+    if (data) {
+        munmap((void*) data, size);
+    }
+}
+
+bool TileDatabase::is_valid() const
+{
+    return header != NULL;
+}
+
+/* The records of a section, NULL if it does not fit in the file
+ */
+template <class Record>
+const Record* TileDatabase::section(const DbSection& s) const
+{
+    if (s.offset > size or s.count > (size - s.offset) / sizeof(Record)) {
+        return NULL;
+    }
+    return (const Record*) (data + s.offset);
+}
+
+string TileDatabase::get_string(DbString s) const
+{
+    return string(section<char>(header->strings) + s.offset, s.length);
+}
+
+/* The source record of a file, NULL if the database was not compiled from
+ * it or it has changed since
+ */
+const DbSource* TileDatabase::find_current_source(string filename) const
+{
+    if (not is_valid()) {
+        return NULL;
+    }
+    const DbSource* sources = section<DbSource>(header->sources);
+    for (uint64_t i = 0; i < header->sources.count; i++) {
+        if (get_string(sources[i].path) != filename) {
+            continue;
+        }
+        int64_t size, mtime_ns;
+        if (stat_source(filename, size, mtime_ns) and size == sources[i].size
+                and mtime_ns == sources[i].mtime_ns) {
+            return &sources[i];
+        }
+        return NULL;
+    }
+    return NULL;
+}
+
+bool TileDatabase::read_tiles(string tile_filename, TileSet& tile_set) const
+{
+    // The tile file is always the first source
+    const DbSource* source = find_current_source(tile_filename);
+    if (not source or source != section<DbSource>(header->sources)) {
+        return false;
+    }
+
+    const DbTile* tiles = section<DbTile>(header->tiles);
+    const DbPlanet* planets = section<DbPlanet>(header->planets);
+    for (uint64_t i = 0; i < header->tiles.count; i++) {
+        const DbTile& db_tile = tiles[i];
+        list<Planet> tile_planets;
+        for (uint32_t p = db_tile.first_planet;
+                p < db_tile.first_planet + db_tile.n_planets; p++) {
+            tile_planets.push_back({get_string(planets[p].name),
+                    planets[p].resources, planets[p].influence,
+                    (PlanetTrait) planets[p].trait, (TechColor) planets[p].tech});
+        }
+
+        string race = get_string(db_tile.race);
+        Tile tile = race.length()
+            ? Tile(db_tile.number, tile_planets, race)
+            : Tile(db_tile.number, tile_planets, (Wormhole) db_tile.wormhole,
+                    (Anomaly) db_tile.anomaly);
+        switch (db_tile.group) {
+            case DB_RED_TILE:
+                tile_set.red_tiles.push_back(tile);
+                break;
+            case DB_BLUE_TILE:
+                tile_set.blue_tiles.push_back(tile);
+                break;
+            case DB_HOME_TILE:
+                tile_set.home_tiles.push_back(tile);
+                break;
+            case DB_MECATOL:
+                tile_set.mecatol = tile;
+                break;
+        }
+    }
+    tile_set.digest = source->digest;
+    return true;
+}
+
+bool TileDatabase::read_layout(string layout_filename, Layout& layout) const
+{
+    const DbSource* source = find_current_source(layout_filename);
+    if (not source) {
+        return false;
+    }
+    uint32_t source_index = source - section<DbSource>(header->sources);
+
+    const DbLayout* layouts = section<DbLayout>(header->layouts);
+    const DbLocation* locations = section<DbLocation>(header->locations);
+    const DbFixedTile* fixed_tiles = section<DbFixedTile>(header->fixed_tiles);
+    const DbPlayerSetup* setups = section<DbPlayerSetup>(header->player_setups);
+    for (uint64_t n = 0; n < header->layouts.count; n++) {
+        const DbLayout& db_layout = layouts[n];
+        if (db_layout.source != source_index) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < db_layout.n_locations; i++) {
+            const DbLocation& l = locations[db_layout.first_location + i];
+            layout.valid_locations.push_back({l.i, l.j});
+        }
+        for (uint32_t i = 0; i < db_layout.n_fixed_tiles; i++) {
+            const DbFixedTile& f = fixed_tiles[db_layout.first_fixed_tile + i];
+            layout.fixed_tiles.push_back({f.number, {f.location.i, f.location.j}});
+        }
+        for (uint32_t i = 0; i < db_layout.n_player_setups; i++) {
+            const DbPlayerSetup& setup = setups[db_layout.first_player_setup + i];
+            struct layout_info info;
+            info.n_blue = setup.n_blue;
+            info.n_red = setup.n_red;
+            for (uint32_t k = 0; k < setup.n_locations; k++) {
+                const DbLocation& l = locations[setup.first_location + k];
+                info.start_positions.push_back({l.i, l.j});
+            }
+            layout.player_setups[setup.n_players] = info;
+        }
+        for (uint32_t i = 0; i < db_layout.n_warp_connections; i++) {
+            const DbLocation* pair = &locations[db_layout.first_warp_location + 2 * i];
+            layout.warp_connections.push_back({{pair[0].i, pair[0].j},
+                    {pair[1].i, pair[1].j}});
+        }
+        layout.digest = source->digest;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,139 @@
+#ifndef TI4_TILE_DATABASE_HPP
+#define TI4_TILE_DATABASE_HPP
+
+#include <cstdint>
+
+#include "galaxy.hpp"
+
+// Bump whenever the layout of the records below changes
+#define TILE_DATABASE_VERSION 1
+
+/* A tile file and any number of layout files compiled into one binary file.
+ * The file is a header followed by sections of fixed size records that
+ * refer to each other by index, so it can be mapped into memory and read in
+ * place without parsing. Every record is made of 32 and 64 bit integers and
+ * the file is only meant to be read on the machine that compiled it
+ */
+typedef struct DbSection
+{
+    uint64_t offset; // From the start of the file
+    uint64_t count;
+} DbSection;
+
+typedef struct DbString
+{
+    uint32_t offset; // Into the strings section
+    uint32_t length;
+} DbString;
+
+typedef struct DbHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t padding;
+    uint64_t file_size;
+    uint64_t checksum; // FNV-1a of everything after the header
+    DbSection sources;
+    DbSection tiles;
+    DbSection planets;
+    DbSection layouts;
+    DbSection locations;
+    DbSection fixed_tiles;
+    DbSection player_setups;
+    DbSection strings;
+} DbHeader;
+
+// A file the database was compiled from, to tell whether it is still current
+typedef struct DbSource
+{
+    DbString path;
+    int64_t size;
+    int64_t mtime_ns;
+    char digest[24]; // content_digest, zero terminated
+} DbSource;
+
+enum DbTileGroup {DB_RED_TILE, DB_BLUE_TILE, DB_HOME_TILE, DB_MECATOL};
+
+typedef struct DbTile
+{
+    int32_t number;
+    int32_t group;
+    int32_t wormhole;
+    int32_t anomaly;
+    DbString race;
+    uint32_t first_planet;
+    uint32_t n_planets;
+} DbTile;
+
+typedef struct DbPlanet
+{
+    DbString name;
+    int32_t resources;
+    int32_t influence;
+    int32_t trait;
+    int32_t tech;
+} DbPlanet;
+
+typedef struct DbLocation
+{
+    int32_t i;
+    int32_t j;
+} DbLocation;
+
+typedef struct DbFixedTile
+{
+    int32_t number;
+    DbLocation location;
+} DbFixedTile;
+
+typedef struct DbPlayerSetup
+{
+    int32_t n_players;
+    int32_t n_blue;
+    int32_t n_red;
+    uint32_t first_location;
+    uint32_t n_locations;
+} DbPlayerSetup;
+
+// Warp connections are pairs of consecutive locations
+typedef struct DbLayout
+{
+    uint32_t source;
+    uint32_t first_location;
+    uint32_t n_locations;
+    uint32_t first_fixed_tile;
+    uint32_t n_fixed_tiles;
+    uint32_t first_player_setup;
+    uint32_t n_player_setups;
+    uint32_t first_warp_location;
+    uint32_t n_warp_connections;
+} DbLayout;
+
+/* A compiled database mapped into memory. A database that is missing,
+ * corrupt or from another version is simply not valid, and reading a file
+ * that is not in it or has changed since it was compiled fails, so callers
+ * can fall back to the json files
+ */
+class TileDatabase
+{
+    const char* data = NULL;
+    size_t size = 0;
+    const DbHeader* header = NULL;
+
+    template <class Record> const Record* section(const DbSection& s) const;
+    string get_string(DbString s) const;
+    const DbSource* find_current_source(string filename) const;
+
+    public:
+    TileDatabase(string db_filename);
+    TileDatabase(const TileDatabase&) = delete;
+    ~TileDatabase();
+    bool is_valid() const;
+    bool read_tiles(string tile_filename, TileSet& tile_set) const;
+    bool read_layout(string layout_filename, Layout& layout) const;
+};
+
+void compile_database(string db_filename, string tile_filename,
+        const vector<string>& layout_filenames);
+
+#endif